@@ -1,10 +1,21 @@
 #include "es_lib/sdl.h"
-#include "es_lib/asset_map.h"
 #include "es_lib/scoped_render.h"
+#include "es_lib/tile_layer.h"
+#include "es_lib/asset_loader.h"
+#include "es_lib/asset_pack.h"
+#include "es_lib/fixed_step.h"
+#include "es_lib/collision.h"
+#include "es_lib/command_buffer.h"
+#include "es_lib/job_system.h"
+#include "es_lib/state_machine.h"
+#include "es_lib/input.h"
+#include "es_lib/particles.h"
+#include "es_lib/snapshot.h"
 #include <memory>
 #include <cstdio>
 #include <cassert>
-#include <functional>
+#include <cstring>
+#include <vector>
 #include <chrono>
 #include <thread>
 
@@ -50,39 +61,91 @@ enum state
 {
 	stationary,
 	free_fall,
+	num_states,
+};
 
+struct player_context
+{
+	es::sdl::sprite const& player;
+	es::sdl::tile_map const& world;
 };
 
-// -- TO DO
-using transition_map = std::unordered_map<state, std::function<state(es::sdl::sprite const&)>>;
+bool landed(player_context const& c, uint32_t) { return es::sdl::on_ground(c.player, c.world); }
+
+bool lost_ground(player_context const& c, uint32_t) { return !es::sdl::on_ground(c.player, c.world); }
 
-static auto& g_transiton_map()
+constexpr es::sdl::transition<state, player_context> player_transitions[] =
 {
-	static transition_map g_map;
-	return g_map;
-}
-// ---
+	{ free_fall, stationary, &landed },
+	{ stationary, free_fall, &lost_ground },
+};
 
-enum class key_action
+using player_state_machine = es::sdl::state_machine<state, player_context, num_states>;
+
+enum key_action : uint32_t
 {
 	move_left,
 	move_right,
 	move_up,
 	move_down,
+	quick_save,
+	quick_load,
+	step_back,
 };
 
-using keyboard_map = std::unordered_map<uint64_t, key_action>;
+constexpr auto player_section = es::sdl::snapshot_tag('P', 'L', 'A', 'Y');
+constexpr auto world_section = es::sdl::snapshot_tag('W', 'R', 'L', 'D');
+constexpr auto particles_section = es::sdl::snapshot_tag('P', 'R', 'T', 'S');
 
 int main(int argc, char *argv[]) try
 {
 	using namespace es::sdl;
 
+	// es_console [--record <file> | --replay <file>]
+	input in;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--record") == 0)
+			in.record(argv[++i]);
+		else if (std::strcmp(argv[i], "--replay") == 0)
+			in.replay(argv[++i]);
+	}
+
+	// Outlives the context: packed surfaces are views into the mapping.
+	asset_pack pack;
+
 	es::sdl::context sdl;
-	sdl.add_texture(0, es::sdl::create_bmp("assets/rect2985.bmp"));
-	sdl.add_texture(1, es::sdl::create_bmp("assets/visual-1.bmp"));
-	sdl.add_texture(20, es::sdl::create_bmp("assets/rect-player.bmp"));
 
-	//sdl.print(es::map);
+	// A pack built with es_pack loads without decoding; fall back to the BMPs.
+	if (pack.open("assets/assets.espk"))
+	{
+		pack.add_textures(sdl);
+	}
+	else
+	{
+		asset_loader loader;
+		loader.load_bmp(0, "assets/rect2985.bmp");
+		loader.load_bmp(1, "assets/visual-1.bmp");
+		loader.load_bmp(20, "assets/rect-player.bmp");
+
+		// one upload per frame keeps the loading screen responsive
+		while (!loader.done())
+		{
+			loader.pump(sdl, 1);
+
+			scoped_render render{ sdl };
+			auto const ws = sdl.get_window_size();
+			auto const bar = SDL_Rect{ ws.first / 4, ws.second / 2 - 10, ws.first / 2, 20 };
+			render.add(bar, SDL_Color{ 64, 64, 64, 255 });
+			render.add(SDL_Rect{ bar.x, bar.y, static_cast<int>(bar.w * loader.progress()), bar.h }, SDL_Color{ 220, 220, 220, 255 });
+		}
+	}
+
+	tile_layer tiles{ {32, 18} };
+	tiles.assign(es::map);
+
+	auto world = tile_map::from(es::map);
+	world.mark_clean();
 
 	es::sdl::sprite spr{};
 	spr.visual = 20;
@@ -90,62 +153,218 @@ int main(int argc, char *argv[]) try
 	spr.size = es::sdl::vecf{ 1.0, 2.0 };
 	//sdl.print(spr, es::map);
 
-	keyboard_map kmap
+	in.bind(SDL_SCANCODE_W, move_up);
+	in.bind(SDL_SCANCODE_S, move_down);
+	in.bind(SDL_SCANCODE_A, move_left);
+	in.bind(SDL_SCANCODE_D, move_right);
+	in.bind(SDL_SCANCODE_F5, quick_save);
+	in.bind(SDL_SCANCODE_F9, quick_load);
+	in.bind(SDL_SCANCODE_BACKSPACE, step_back);
+
+	player_state_machine player_fsm{ player_transitions };
+
+	// Landing puffs; the emitter only bursts, so its rate stays 0.
+	emitter_config dust_config;
+	if (!load_emitter("assets/dust.emitter", dust_config))
+	{
+		dust_config.visual = 1;
+		dust_config.lifetime_max = 0.5f;
+	}
+	// Simulated with the ticks on the worker. The main thread draws a copy
+	// taken from the last tick's snapshot, one frame behind like the player.
+	particle_system particles{ 4096 };
+	particle_system drawn_particles{ 4096 };
+	auto const dust = particles.add_emitter(dust_config, vecf{ 0.0f, 0.0f });
+	drawn_particles.add_emitter(dust_config, vecf{ 0.0f, 0.0f });
+
+	constexpr auto gravity = 40.0f;		// blocks per second squared
+	constexpr auto jump_speed = 16.0f;	// blocks per second
+	auto player_state = free_fall;
+
+	fixed_step step{ 60 };
+	auto previous = spr;
+
+	// Simulation state as a snapshot: the player, its state machine state,
+	// the tiles changed since the level was loaded and the particles with
+	// their generator. A restored world is copied into the drawn tile layer
+	// on the main thread once the tick job is done.
+	bool world_restored = false;
+	auto const save_state = [&](std::vector<uint8_t>& out)
 	{
-		{SDL_SCANCODE_W, key_action::move_up},
-		{SDL_SCANCODE_S, key_action::move_down},
-		{SDL_SCANCODE_A, key_action::move_left},
-		{SDL_SCANCODE_D, key_action::move_right}
+		snapshot_writer w{ out };
+		w.begin(player_section);
+		w.write(spr);
+		w.write(previous);
+		w.write(player_state);
+		w.end();
+		w.begin(world_section);
+		world.save(w);
+		w.end();
+		w.begin(particles_section);
+		particles.save(w);
+		w.end();
+		w.finish();
 	};
+	auto const load_state = [&](std::vector<uint8_t> const& snapshot)
+	{
+		snapshot_reader r{ snapshot };
+		uint32_t tag;
+		while (r.next(tag))
+		{
+			if (tag == player_section)
+			{
+				r.read(spr);
+				r.read(previous);
+				r.read(player_state);
+			}
+			else if (tag == world_section)
+			{
+				if (!world.load(r))
+					return false;
+				world_restored = true;
+			}
+			else if (tag == particles_section)
+			{
+				if (!particles.load(r))
+					return false;
+			}
+		}
+		return r.ok();
+	};
+
+	// Backspace steps back through the last ten seconds, one tick per tick.
+	snapshot_history history{ 600, 60 };
+	std::vector<uint8_t> tick_snapshot;
+	std::vector<uint8_t> quick_save_snapshot;
+
+	sdl.profiler().set_spike_dump(std::chrono::milliseconds(50), "es_spike_trace.json");
+
+	// The next frame is simulated and recorded on a worker while the main
+	// thread draws and presents the previous one. One worker on purpose:
+	// every tick needs the one before it and there is a single player, so a
+	// frame is one job with nothing to split or steal.
+	job_system jobs{ 1 };
+	render_pipeline pipeline;
+	record_target target;
+
+	std::vector<action_state> tick_input;
 
-	bool quit = false;
-	while (!quit)
+	while (!in.quit_requested())
 	{
-		//SDL_Event evt;
-		//while (SDL_PollEvent(&evt))
-		//{
-		//	if (evt.type == SDL_QUIT)
-		//	{
-		//		quit = true;
-		//	}
-		//}
+		auto const ticks = step.advance();
 
-		SDL_PumpEvents();
+		{
+			profile_scope input_scope{ sdl.profiler(), frame_phase::input };
+			tick_input.clear();
+			for (auto t = ticks; t; t--)
+			{
+				in.poll();
+				tick_input.push_back(in.state());
+			}
+		}
 
-		scoped_render render{ sdl, {32, 18} };
+		resolve(sdl, target);
 
-		auto keystate = SDL_GetKeyboardState(nullptr);
-		for (auto const& k : kmap)
+		job_counter simulated;
+		auto update_begin = frame_profiler::clock_t::now();
+		auto update_end = update_begin;
+		jobs.run([&]
 		{
-			if (keystate[k.first])
+			update_begin = frame_profiler::clock_t::now();
+			for (auto const& actions : tick_input)
 			{
-				//printf("first: %u -> %u\n", k.first, keystate[k.first]);
-				auto action = k.second;
-				constexpr auto speed = 0.1;
-				if (action == key_action::move_up)
+				if (actions.is_held(step_back))
 				{
-					spr.position.y -= speed;
+					if (history.pop(tick_snapshot))
+						load_state(tick_snapshot);
+					previous = spr;
+					continue;
 				}
-				if (action == key_action::move_down)
+
+				constexpr auto speed = 6.0f;	// blocks per second
+				spr.velocity.x = 0.0f;
+				if (actions.is_held(move_left))
+					spr.velocity.x -= speed;
+				if (actions.is_held(move_right))
+					spr.velocity.x += speed;
+
+				auto const jump = actions.is_held(move_up);
+				auto const fast_fall = actions.is_held(move_down);
+
+				previous = spr;
+
+				for (auto const& e : player_fsm.update(player_context{ spr, world }, &player_state, 1))
 				{
-					spr.position.y += speed;
+					if (e.to == stationary)
+					{
+						particles.set_position(dust, vecf{ spr.position.x + 0.5f * spr.size.x, spr.position.y + spr.size.y });
+						particles.burst(dust, 24);
+					}
 				}
-				if (action == key_action::move_left)
+				if (player_state == stationary && jump)
 				{
-					spr.position.x -= speed;
+					spr.velocity.y = -jump_speed;
+					player_state = free_fall;
 				}
-				if (action == key_action::move_right)
+				spr.acceleration.y = player_state == free_fall ? (fast_fall ? 2 * gravity : gravity) : 0.0f;
+
+				move_and_collide(spr, world, step.dt());
+
+				// fell off the bottom of the map
+				if (spr.position.y > world.height())
 				{
-					spr.position.x += speed;
-					//printf("moving right: {%f, %f}\n", spr.position.x, spr.position.y);
+					spr.position = vecf{ 0.0f, 0.0f };
+					spr.velocity = vecf{ 0.0f, 0.0f };
+					previous = spr;
 				}
+
+				particles.update(step.dt());
+
+				if (actions.was_pressed(quick_load) && !quick_save_snapshot.empty() && load_state(quick_save_snapshot))
+					history.clear();
+				save_state(tick_snapshot);
+				history.push(tick_snapshot);
+				if (actions.was_pressed(quick_save))
+					quick_save_snapshot = tick_snapshot;
 			}
+
+			scoped_render record{ target, {32, 18}, pipeline.back() };
+			record.add(interpolate(previous, spr, step.alpha()));
+			update_end = frame_profiler::clock_t::now();
+		}, &simulated);
+
+		{
+			scoped_render render{ sdl, {32, 18} };
+
+			render.add_to_background(sdl.texture_at(0));
+			render.add(tiles);
+			render.add(pipeline.front());
+			render.add(drawn_particles);
 		}
 
-		render.add_to_background(sdl.texture_at(0));
-		render.add(es::map);
-		render.add(spr);
+		jobs.wait(simulated);
+		pipeline.swap();
+
+		if (world_restored)
+		{
+			tiles.assign(world);
+			world_restored = false;
+		}
+
+		// the last tick's state; also current when this frame had no tick
+		if (!tick_snapshot.empty())
+		{
+			snapshot_reader r{ tick_snapshot };
+			uint32_t tag;
+			while (r.next(tag))
+			{
+				if (tag == particles_section)
+					drawn_particles.load(r);
+			}
+		}
 
+		// overlapped with the frame just presented; counted in the next one
+		sdl.profiler().record(frame_phase::update, update_begin, update_end);
 	}
 
 	printf("JOBS DONE\n");
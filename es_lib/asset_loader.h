@@ -0,0 +1,235 @@
+#pragma once
+
+#include "sdl.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace es { namespace sdl {
+
+enum class asset_status : uint32_t
+{
+	queued,
+	decoding,
+	decoded,	// surface converted, waiting for texture upload
+	ready,		// texture and surface stored in the context's resources
+	failed,
+};
+
+namespace detail
+{
+	struct asset_request
+	{
+		asset_request(uint32_t i, std::string p) : id{ i }, path{ std::move(p) } {}
+
+		uint32_t id;
+		std::string path;
+		std::atomic<asset_status> status{ asset_status::queued };
+		surface_t surface;
+	};
+}
+
+// Future-style view of a single load. Cheap to copy; the status can be
+// polled from any thread.
+class asset_handle
+{
+public:
+	asset_handle() = default;
+
+	explicit asset_handle(std::shared_ptr<detail::asset_request> r) : m_request{ std::move(r) } {}
+
+	bool valid() const noexcept { return m_request != nullptr; }
+
+	uint32_t id() const noexcept { return m_request->id; }
+
+	asset_status status() const noexcept { return m_request->status.load(std::memory_order_acquire); }
+
+	bool ready() const noexcept { return status() == asset_status::ready; }
+
+	bool failed() const noexcept { return status() == asset_status::failed; }
+
+private:
+	std::shared_ptr<detail::asset_request> m_request;
+};
+
+// Loads BMP assets in the background. Worker threads decode and convert the
+// files to RGBA32; the render thread then creates the textures in pump(), a
+// bounded number per call, so a loading screen or placeholders can keep
+// being drawn meanwhile. The surfaces are kept with their textures in the
+// context's resource registry.
+class asset_loader
+{
+public:
+	explicit asset_loader(unsigned num_threads = default_num_threads())
+	{
+		for (unsigned i = 0; i < std::max(num_threads, 1u); i++)
+		{
+			m_workers.emplace_back([this] { work(); });
+		}
+	}
+
+	asset_loader(asset_loader const&) = delete;
+	asset_loader& operator=(asset_loader const&) = delete;
+
+	~asset_loader()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_stopping = true;
+		}
+		m_work_available.notify_all();
+		for (auto& t : m_workers)
+		{
+			t.join();
+		}
+	}
+
+	asset_handle load_bmp(uint32_t id, std::string path)
+	{
+		auto r = std::make_shared<detail::asset_request>(id, std::move(path));
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_queued.push_back(r);
+			m_requested++;
+		}
+		m_work_available.notify_one();
+		return asset_handle{ r };
+	}
+
+	// Render thread only. Uploads up to max_uploads decoded surfaces and
+	// returns the number uploaded.
+	size_t pump(context& c, size_t max_uploads = SIZE_MAX)
+	{
+		size_t uploaded = 0;
+		while (uploaded < max_uploads)
+		{
+			std::shared_ptr<detail::asset_request> r;
+			{
+				std::lock_guard<std::mutex> lock{ m_mutex };
+				if (m_decoded.empty())
+					break;
+
+				r = std::move(m_decoded.front());
+				m_decoded.pop_front();
+			}
+
+			c.add_surface(r->id, std::move(r->surface));
+			r->status.store(asset_status::ready, std::memory_order_release);
+			uploaded++;
+
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_finished++;
+		}
+		return uploaded;
+	}
+
+	// Render thread only. Blocks until every requested asset is ready or failed.
+	void finish(context& c)
+	{
+		while (!done())
+		{
+			{
+				std::unique_lock<std::mutex> lock{ m_mutex };
+				m_decode_finished.wait(lock, [this] { return !m_decoded.empty() || m_finished == m_requested; });
+			}
+			pump(c);
+		}
+	}
+
+	// Fraction of requested assets that are ready or failed.
+	float progress() const
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		return m_requested ? static_cast<float>(m_finished) / m_requested : 1.0f;
+	}
+
+	bool done() const
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		return m_finished == m_requested;
+	}
+
+private:
+	static unsigned default_num_threads()
+	{
+		auto const n = std::thread::hardware_concurrency();
+		return n > 1 ? n - 1 : 1;
+	}
+
+	static surface_t decode(std::string const& path)
+	{
+		auto image = surface_t{ SDL_LoadBMP(path.c_str()) };
+		if (!image)
+		{
+			printf("Fail | SDL_LoadBMP(%s) -> %s\n", path.c_str(), SDL_GetError());
+			return nullptr;
+		}
+
+		auto converted = surface_t{ SDL_ConvertSurfaceFormat(image.get(), SDL_PIXELFORMAT_RGBA32, 0) };
+		if (!converted)
+		{
+			printf("Fail | SDL_ConvertSurfaceFormat(%s) -> %s\n", path.c_str(), SDL_GetError());
+		}
+		return converted;
+	}
+
+	void work()
+	{
+		for (;;)
+		{
+			std::shared_ptr<detail::asset_request> r;
+			{
+				std::unique_lock<std::mutex> lock{ m_mutex };
+				m_work_available.wait(lock, [this] { return m_stopping || !m_queued.empty(); });
+				if (m_stopping)
+					return;
+
+				r = std::move(m_queued.front());
+				m_queued.pop_front();
+			}
+
+			r->status.store(asset_status::decoding, std::memory_order_relaxed);
+			r->surface = decode(r->path);
+
+			{
+				std::lock_guard<std::mutex> lock{ m_mutex };
+				if (r->surface)
+				{
+					r->status.store(asset_status::decoded, std::memory_order_release);
+					m_decoded.push_back(std::move(r));
+				}
+				else
+				{
+					r->status.store(asset_status::failed, std::memory_order_release);
+					m_finished++;
+				}
+			}
+			m_decode_finished.notify_all();
+		}
+	}
+
+	mutable std::mutex m_mutex;
+
+	std::condition_variable m_work_available;
+
+	std::condition_variable m_decode_finished;
+
+	std::deque<std::shared_ptr<detail::asset_request>> m_queued;
+
+	std::deque<std::shared_ptr<detail::asset_request>> m_decoded;
+
+	size_t m_requested = 0;
+
+	size_t m_finished = 0;
+
+	bool m_stopping = false;
+
+	std::vector<std::thread> m_workers;
+};
+
+}}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "sdl.h"
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace es { namespace sdl {
+
+// Pack file layout, little-endian:
+//
+//	asset_pack_header
+//	asset_pack_entry[count]
+//	pixel data, each image starting on a 16 byte boundary
+//
+// Pixels are stored as R, G, B, A bytes (SDL_PIXELFORMAT_RGBA32) with the
+// given pitch, ready to be used without conversion.
+struct asset_pack_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct asset_pack_entry
+{
+	uint32_t id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	uint64_t offset;
+	uint64_t size;
+};
+
+constexpr static char asset_pack_magic[4] = { 'E', 'S', 'P', 'K' };
+
+constexpr static auto asset_pack_version = uint32_t{ 1 };
+
+constexpr static auto asset_pack_alignment = uint64_t{ 16 };
+
+// Writes the given RGBA32 surfaces into a pack file. Returns false on I/O
+// errors or surfaces in another format.
+inline bool write_asset_pack(char const* path, std::vector<std::pair<uint32_t, SDL_Surface*>> const& assets)
+{
+	auto const align = [](uint64_t v) { return (v + asset_pack_alignment - 1) & ~(asset_pack_alignment - 1); };
+
+	auto header = asset_pack_header{};
+	std::memcpy(header.magic, asset_pack_magic, sizeof(header.magic));
+	header.version = asset_pack_version;
+	header.count = static_cast<uint32_t>(assets.size());
+
+	std::vector<asset_pack_entry> entries;
+	auto offset = align(sizeof(header) + sizeof(asset_pack_entry) * assets.size());
+	for (auto const& a : assets)
+	{
+		auto const s = a.second;
+		if (!s || s->format->format != SDL_PIXELFORMAT_RGBA32)
+		{
+			printf("Fail | asset %u is not an RGBA32 surface\n", a.first);
+			return false;
+		}
+
+		auto const size = static_cast<uint64_t>(s->pitch) * s->h;
+		entries.push_back(asset_pack_entry{ a.first, static_cast<uint32_t>(s->w), static_cast<uint32_t>(s->h), static_cast<uint32_t>(s->pitch), offset, size });
+		offset = align(offset + size);
+	}
+
+	auto const file = std::unique_ptr<FILE, int(*)(FILE*)>{ std::fopen(path, "wb"), &std::fclose };
+	if (!file)
+	{
+		printf("Fail | could not open '%s' for writing\n", path);
+		return false;
+	}
+
+	auto ok = std::fwrite(&header, sizeof(header), 1, file.get()) == 1;
+	if (!entries.empty())
+		ok = ok && std::fwrite(entries.data(), sizeof(asset_pack_entry), entries.size(), file.get()) == entries.size();
+
+	char const zeros[asset_pack_alignment] = {};
+	auto written = static_cast<uint64_t>(sizeof(header) + sizeof(asset_pack_entry) * entries.size());
+	for (size_t i = 0; ok && i < entries.size(); i++)
+	{
+		auto const pad = entries[i].offset - written;
+		ok = !pad || std::fwrite(zeros, 1, static_cast<size_t>(pad), file.get()) == pad;
+
+		SDL_LockSurface(assets[i].second);
+		ok = ok && std::fwrite(assets[i].second->pixels, 1, static_cast<size_t>(entries[i].size), file.get()) == entries[i].size;
+		SDL_UnlockSurface(assets[i].second);
+		written = entries[i].offset + entries[i].size;
+	}
+
+	if (!ok)
+		printf("Fail | writing '%s'\n", path);
+	return ok;
+}
+
+// Read side of the pack format. The file is memory-mapped and surfaces are
+// created directly over the mapped pixels, so nothing is decoded or copied
+// until a texture is created. Surfaces from create_surface() must not
+// outlive the pack. The mapping is copy-on-write, so writes through a
+// surface never reach the file.
+class asset_pack
+{
+public:
+	asset_pack() = default;
+
+	asset_pack(asset_pack const&) = delete;
+	asset_pack& operator=(asset_pack const&) = delete;
+
+	~asset_pack() { close(); }
+
+	bool open(char const* path)
+	{
+		close();
+		if (!map(path))
+			return false;
+
+		if (m_size < sizeof(asset_pack_header))
+			return fail(path, "truncated header");
+
+		auto const& h = header();
+		if (std::memcmp(h.magic, asset_pack_magic, sizeof(h.magic)) != 0 || h.version != asset_pack_version)
+			return fail(path, "not a version 1 asset pack");
+
+		if (sizeof(asset_pack_header) + sizeof(asset_pack_entry) * static_cast<uint64_t>(h.count) > m_size)
+			return fail(path, "truncated index");
+
+		for (uint32_t i = 0; i < h.count; i++)
+		{
+			auto const& e = entry(i);
+			if (e.offset % asset_pack_alignment || e.offset > m_size || e.size > m_size - e.offset
+				|| e.pitch < e.width * 4 || static_cast<uint64_t>(e.pitch) * e.height > e.size)
+				return fail(path, "corrupt entry");
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (!m_data)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(m_data, m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	bool is_open() const noexcept { return m_data != nullptr; }
+
+	uint32_t size() const noexcept { return m_data ? header().count : 0; }
+
+	asset_pack_entry const& entry(uint32_t i) const
+	{
+		assert(i < size());
+		return reinterpret_cast<asset_pack_entry const*>(m_data + sizeof(asset_pack_header))[i];
+	}
+
+	surface_t create_surface(uint32_t i) const
+	{
+		auto const& e = entry(i);
+		return surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormatFrom(m_data + e.offset,
+			static_cast<int>(e.width), static_cast<int>(e.height), 32, static_cast<int>(e.pitch), SDL_PIXELFORMAT_RGBA32)) };
+	}
+
+	// Creates a texture in the context for every image in the pack. The
+	// surfaces point into the mapped file and are kept for
+	// get_visual_as_surface, so the pack must stay open while c uses them.
+	void add_textures(context& c) const
+	{
+		for (uint32_t i = 0; i < size(); i++)
+		{
+			c.add_surface(entry(i).id, create_surface(i));
+		}
+	}
+
+private:
+	asset_pack_header const& header() const { return *reinterpret_cast<asset_pack_header const*>(m_data); }
+
+	bool fail(char const* path, char const* reason)
+	{
+		printf("Fail | asset pack '%s': %s\n", path, reason);
+		close();
+		return false;
+	}
+
+#ifdef _WIN32
+	bool map(char const* path)
+	{
+		auto const file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+
+		m_data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+		CloseHandle(mapping);
+		m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
+		return m_data != nullptr;
+	}
+#else
+	bool map(char const* path)
+	{
+		auto const fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		}
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+
+		m_data = static_cast<uint8_t*>(data);
+		m_size = static_cast<size_t>(st.st_size);
+		return true;
+	}
+#endif
+
+	uint8_t* m_data = nullptr;
+
+	size_t m_size = 0;
+};
+
+}}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "sdl.h"
+#include "canvas.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace es { namespace sdl {
+
+struct atlas_entry
+{
+	constexpr static auto no_page = uint32_t{ 0xffffffff };
+
+	uint32_t page = no_page;
+	SDL_Rect rect;
+};
+
+// A quad from an atlas page, or with page == atlas_entry::no_page a draw
+// that bypasses the atlas: a copy of texture, or a fill of dest with color
+// when texture is null.
+struct batch_quad
+{
+	uint32_t layer;
+	uint32_t page;
+	SDL_Rect src;
+	SDL_Rect dest;
+	SDL_Texture* texture;
+	SDL_Color color;
+};
+
+// Collects the draws of a frame so they can be submitted grouped by atlas
+// page. Draws are submitted in layer order; within a layer atlas quads go
+// first, grouped by page, then the other draws in the order they were added.
+class render_batch
+{
+public:
+	void add(atlas_entry const& e, SDL_Rect dest, uint32_t layer = 0)
+	{
+		m_quads.push_back(batch_quad{ layer, e.page, e.rect, dest, nullptr, SDL_Color{ 0, 0, 0, 0 } });
+	}
+
+	// src null copies the whole texture.
+	void add(SDL_Texture& t, SDL_Rect const* src, SDL_Rect dest, uint32_t layer = 0)
+	{
+		auto r = SDL_Rect{ 0, 0, 0, 0 };
+		if (src)
+			r = *src;
+		else
+			SDL_QueryTexture(&t, nullptr, nullptr, &r.w, &r.h);
+		m_quads.push_back(batch_quad{ layer, atlas_entry::no_page, r, dest, &t, SDL_Color{ 0, 0, 0, 0 } });
+	}
+
+	void add(SDL_Rect r, SDL_Color color, uint32_t layer = 0)
+	{
+		m_quads.push_back(batch_quad{ layer, atlas_entry::no_page, SDL_Rect{ 0, 0, 0, 0 }, r, nullptr, color });
+	}
+
+	bool empty() const noexcept { return m_quads.empty(); }
+
+	size_t size() const noexcept { return m_quads.size(); }
+
+	// page_at returns the page's texture, or its RGBA32 surface without
+	// SDL_RenderGeometry.
+	template <typename PageFn>
+	void submit(context& c, PageFn&& page_at)
+	{
+		std::stable_sort(m_quads.begin(), m_quads.end(), [](batch_quad const& a, batch_quad const& b)
+		{
+			return a.layer != b.layer ? a.layer < b.layer : a.page < b.page;
+		});
+
+		auto first = m_quads.begin();
+		while (first != m_quads.end())
+		{
+			if (first->page == atlas_entry::no_page)
+			{
+				if (first->texture)
+					c.render_copy(*first->texture, &first->src, &first->dest);
+				else
+					c.fill_rect(first->dest, first->color);
+				++first;
+				continue;
+			}
+
+			auto const last = std::find_if(first, m_quads.end(), [&](batch_quad const& q) { return !same_run(*first, q); });
+			submit_run(c, page_at, first, last);
+			first = last;
+		}
+		m_quads.clear();
+	}
+
+private:
+	using iterator = std::vector<batch_quad>::iterator;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	static bool same_run(batch_quad const& a, batch_quad const& b) { return a.layer == b.layer && a.page == b.page; }
+
+	template <typename PageFn>
+	void submit_run(context& c, PageFn& page_at, iterator first, iterator last)
+	{
+		auto& t = page_at(first->page);
+		int w, h;
+		SDL_QueryTexture(&t, nullptr, nullptr, &w, &h);
+		auto const sx = 1.0f / w;
+		auto const sy = 1.0f / h;
+
+		m_vertices.clear();
+		m_indices.clear();
+		for (auto it = first; it != last; ++it)
+		{
+			auto const& s = it->src;
+			auto const& d = it->dest;
+			auto const base = static_cast<int>(m_vertices.size());
+			auto const white = SDL_Color{ 255, 255, 255, 255 };
+
+			m_vertices.push_back(SDL_Vertex{ SDL_FPoint{ float(d.x), float(d.y) }, white, SDL_FPoint{ s.x * sx, s.y * sy } });
+			m_vertices.push_back(SDL_Vertex{ SDL_FPoint{ float(d.x + d.w), float(d.y) }, white, SDL_FPoint{ (s.x + s.w) * sx, s.y * sy } });
+			m_vertices.push_back(SDL_Vertex{ SDL_FPoint{ float(d.x + d.w), float(d.y + d.h) }, white, SDL_FPoint{ (s.x + s.w) * sx, (s.y + s.h) * sy } });
+			m_vertices.push_back(SDL_Vertex{ SDL_FPoint{ float(d.x), float(d.y + d.h) }, white, SDL_FPoint{ s.x * sx, (s.y + s.h) * sy } });
+
+			int const quad[] = { 0, 1, 2, 0, 2, 3 };
+			for (auto const i : quad)
+				m_indices.push_back(base + i);
+		}
+		c.render_geometry(t, m_vertices.data(), static_cast<int>(m_vertices.size()), m_indices.data(), static_cast<int>(m_indices.size()));
+	}
+
+	std::vector<SDL_Vertex> m_vertices;
+
+	std::vector<int> m_indices;
+#else
+	// Pages are read on the CPU, so every atlas quad up to the next draw
+	// that bypasses the atlas joins one run, whatever its page or layer.
+	static bool same_run(batch_quad const&, batch_quad const& b) { return b.page != atlas_entry::no_page; }
+
+	// Without SDL_RenderGeometry the run is composited from the pages'
+	// surfaces and drawn with a single copy.
+	template <typename PageFn>
+	void submit_run(context& c, PageFn& page_at, iterator first, iterator last)
+	{
+		auto x0 = std::numeric_limits<int>::max(), y0 = x0;
+		auto x1 = std::numeric_limits<int>::min(), y1 = x1;
+		for (auto it = first; it != last; ++it)
+		{
+			x0 = std::min(x0, it->dest.x);
+			y0 = std::min(y0, it->dest.y);
+			x1 = std::max(x1, it->dest.x + it->dest.w);
+			y1 = std::max(y1, it->dest.y + it->dest.h);
+		}
+		if (!m_canvas.begin(c, SDL_Rect{ x0, y0, x1 - x0, y1 - y0 }))
+			return;
+
+		for (auto it = first; it != last; ++it)
+		{
+			m_canvas.blend(page_at(it->page), it->src, it->dest);
+		}
+		m_canvas.end(c);
+	}
+
+	streaming_canvas m_canvas;
+#endif
+
+	std::vector<batch_quad> m_quads;
+};
+
+// Packs loaded surfaces into a few large textures. Surfaces are queued with
+// add() and packed into pages on build(); afterwards entries are looked up by
+// the same ids used for context::add_texture.
+class texture_atlas
+{
+public:
+	explicit texture_atlas(int page_size = 2048)
+		: m_page_size{ page_size }
+	{
+	}
+
+	void add(uint32_t id, surface_t surface)
+	{
+		assert(surface);
+		m_pending.push_back(pending{ id, std::move(surface) });
+	}
+
+	void build(context& c)
+	{
+		auto const max_size = c.max_texture_size();
+		auto page_w = m_page_size;
+		auto page_h = m_page_size;
+		if (max_size.x > 0) page_w = std::min(page_w, max_size.x);
+		if (max_size.y > 0) page_h = std::min(page_h, max_size.y);
+
+		// tallest first keeps shelves tightly filled
+		std::sort(m_pending.begin(), m_pending.end(), [](pending const& a, pending const& b)
+		{
+			return a.surface->h > b.surface->h;
+		});
+
+		std::vector<page_builder> builders;
+		for (auto& p : m_pending)
+		{
+			auto const w = p.surface->w + padding;
+			auto const h = p.surface->h + padding;
+
+			auto entry = atlas_entry{};
+			for (size_t i = 0; i < builders.size() && entry.page == atlas_entry::no_page; i++)
+			{
+				if (builders[i].place(w, h, entry.rect))
+					entry.page = static_cast<uint32_t>(m_pages.size() + i);
+			}
+
+			if (entry.page == atlas_entry::no_page)
+			{
+				builders.emplace_back(std::max(page_w, w), std::max(page_h, h));
+				builders.back().place(w, h, entry.rect);
+				entry.page = static_cast<uint32_t>(m_pages.size() + builders.size() - 1);
+			}
+
+			entry.rect.w = p.surface->w;
+			entry.rect.h = p.surface->h;
+
+			auto& b = builders[entry.page - m_pages.size()];
+			if (!b.surface)
+			{
+				b.surface = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, b.width, b.height, 32, SDL_PIXELFORMAT_RGBA32)) };
+			}
+
+			// copy pixels including alpha rather than blending them in
+			SDL_SetSurfaceBlendMode(p.surface.get(), SDL_BLENDMODE_NONE);
+			ES_EXPECT_SDL_ZERO(SDL_BlitSurface(p.surface.get(), nullptr, b.surface.get(), &entry.rect));
+
+			if (p.id >= m_entries.size())
+				m_entries.resize(p.id + 1);
+			m_entries[p.id] = entry;
+		}
+		m_pending.clear();
+
+		for (auto& b : builders)
+		{
+			m_pages.push_back(c.create_texture(b.surface.get()));
+			ES_EXPECT_SDL_ZERO(SDL_SetTextureBlendMode(m_pages.back().get(), SDL_BLENDMODE_BLEND));
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+			m_page_surfaces.push_back(std::move(b.surface));
+#endif
+		}
+	}
+
+	bool contains(uint32_t id) const noexcept
+	{
+		return id < m_entries.size() && m_entries[id].page != atlas_entry::no_page;
+	}
+
+	atlas_entry const& at(uint32_t id) const
+	{
+		assert(contains(id));
+		return m_entries[id];
+	}
+
+	SDL_Texture& page(uint32_t i) { return *m_pages[i]; }
+
+	size_t num_pages() const noexcept { return m_pages.size(); }
+
+	render_batch& batch() noexcept { return m_batch; }
+
+	void submit(context& c)
+	{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		m_batch.submit(c, [this](uint32_t p) -> SDL_Texture& { return page(p); });
+#else
+		m_batch.submit(c, [this](uint32_t p) -> SDL_Surface const& { return *m_page_surfaces[p]; });
+#endif
+	}
+
+private:
+	constexpr static auto padding = int{ 1 };
+
+	struct pending
+	{
+		uint32_t id;
+		surface_t surface;
+	};
+
+	struct page_builder
+	{
+		page_builder(int w, int h) : width{ w }, height{ h } {}
+
+		int width;
+		int height;
+		surface_t surface;
+
+		int shelf_y = 0;
+		int shelf_h = 0;
+		int cursor_x = 0;
+
+		bool place(int w, int h, SDL_Rect& out)
+		{
+			if (cursor_x + w > width)
+			{
+				shelf_y += shelf_h;
+				shelf_h = 0;
+				cursor_x = 0;
+			}
+			if (w > width || shelf_y + h > height)
+				return false;
+
+			out = SDL_Rect{ cursor_x, shelf_y, w, h };
+			cursor_x += w;
+			shelf_h = std::max(shelf_h, h);
+			return true;
+		}
+	};
+
+	int m_page_size;
+
+	std::vector<pending> m_pending;
+
+	std::vector<atlas_entry> m_entries;
+
+	std::vector<texture_t> m_pages;
+
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+	// kept for compositing batches on the CPU
+	std::vector<surface_t> m_page_surfaces;
+#endif
+
+	render_batch m_batch;
+};
+
+}}
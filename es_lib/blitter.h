@@ -0,0 +1,463 @@
+#pragma once
+
+#include <SDL/SDL_rect.h>
+#include <SDL/SDL_surface.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#ifndef ES_HAS_SSE2
+#define ES_HAS_SSE2 1
+#endif
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled in regardless of the target flags and only
+// picked when the CPU reports support.
+#if defined(ES_HAS_SSE2) && (defined(_MSC_VER) || defined(__GNUC__))
+#define ES_HAS_AVX2_DISPATCH 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ES_TARGET_AVX2
+#else
+#define ES_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace es { namespace sdl {
+
+enum class blit_filter
+{
+	nearest,
+	bilinear,
+};
+
+struct blit_quad
+{
+	SDL_Surface* surface;
+	SDL_Rect src;
+	SDL_Rect dest;
+};
+
+namespace detail
+{
+	// Exact (x + 127) / 255 for the products below.
+	inline uint32_t div255(uint32_t x) { x += 128; return (x + (x >> 8)) >> 8; }
+
+	// SDL_BLENDMODE_BLEND: rgb = s * a + d * (1 - a), alpha = a + d * (1 - a).
+	// Forcing the source alpha byte to 255 lets all four bytes share one formula.
+	inline uint32_t blend_pixel(uint32_t s, uint32_t d, uint32_t ashift)
+	{
+		auto const a = (s >> ashift) & 0xff;
+		s |= 0xffu << ashift;
+
+		uint32_t out = 0;
+		for (uint32_t c = 0; c < 32; c += 8)
+		{
+			out |= div255(((s >> c) & 0xff) * a + ((d >> c) & 0xff) * (255 - a)) << c;
+		}
+		return out;
+	}
+
+	// Weights are 8 bit fractions; w is the weight of b.
+	inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t w)
+	{
+		uint32_t out = 0;
+		for (uint32_t c = 0; c < 32; c += 8)
+		{
+			out |= ((((a >> c) & 0xff) * (256 - w) + ((b >> c) & 0xff) * w) >> 8) << c;
+		}
+		return out;
+	}
+
+	// Moves each byte of a pixel from shift from[c] to shift to[c].
+	struct swizzle
+	{
+		uint32_t from[4];
+		uint32_t to[4];
+	};
+
+	inline void swizzle_span_scalar(uint32_t* p, size_t n, swizzle const& sw)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			uint32_t out = 0;
+			for (size_t c = 0; c < 4; c++)
+			{
+				out |= ((p[i] >> sw.from[c]) & 0xff) << sw.to[c];
+			}
+			p[i] = out;
+		}
+	}
+
+	inline void blend_span_scalar(uint32_t* d, uint32_t const* s, size_t n, uint32_t ashift)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			d[i] = blend_pixel(s[i], d[i], ashift);
+		}
+	}
+
+	inline void bilinear_span_scalar(uint32_t* out, uint32_t const* r0, uint32_t const* r1, int32_t const* x0, int32_t const* x1, uint16_t const* fx, uint32_t fy, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			auto const top = lerp_pixel(r0[x0[i]], r0[x1[i]], fx[i]);
+			auto const bottom = lerp_pixel(r1[x0[i]], r1[x1[i]], fx[i]);
+			out[i] = lerp_pixel(top, bottom, fy);
+		}
+	}
+
+#if defined(ES_HAS_SSE2)
+	inline __m128i blend_16(__m128i s, __m128i d, __m128i a)
+	{
+		auto const t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a))), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	}
+
+	inline void blend_span_sse2(uint32_t* d, uint32_t const* s, size_t n, uint32_t ashift)
+	{
+		auto const zero = _mm_setzero_si128();
+		auto const shift = _mm_cvtsi32_si128(static_cast<int>(ashift));
+		auto const amask = _mm_set1_epi32(static_cast<int>(0xffu << ashift));
+
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			auto const src = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i));
+			auto const dst = _mm_loadu_si128(reinterpret_cast<__m128i const*>(d + i));
+
+			// each pixel's alpha in all four of its bytes
+			auto a = _mm_and_si128(_mm_srl_epi32(src, shift), _mm_set1_epi32(0xff));
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+
+			auto const s1 = _mm_or_si128(src, amask);
+			auto const lo = blend_16(_mm_unpacklo_epi8(s1, zero), _mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(a, zero));
+			auto const hi = blend_16(_mm_unpackhi_epi8(s1, zero), _mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(a, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_packus_epi16(lo, hi));
+		}
+		blend_span_scalar(d + i, s + i, n - i, ashift);
+	}
+
+	inline void swizzle_span_sse2(uint32_t* p, size_t n, swizzle const& sw)
+	{
+		__m128i from[4], to[4];
+		for (size_t c = 0; c < 4; c++)
+		{
+			from[c] = _mm_cvtsi32_si128(static_cast<int>(sw.from[c]));
+			to[c] = _mm_cvtsi32_si128(static_cast<int>(sw.to[c]));
+		}
+		auto const byte = _mm_set1_epi32(0xff);
+
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+			auto out = _mm_setzero_si128();
+			for (size_t c = 0; c < 4; c++)
+			{
+				out = _mm_or_si128(out, _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(v, from[c]), byte), to[c]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), out);
+		}
+		swizzle_span_scalar(p + i, n - i, sw);
+	}
+
+	// Two pixels per iteration, one per 64 bit half.
+	inline __m128i lerp_16(__m128i a, __m128i b, __m128i w)
+	{
+		auto const t = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), w)), _mm_mullo_epi16(b, w));
+		return _mm_srli_epi16(t, 8);
+	}
+
+	inline void bilinear_span_sse2(uint32_t* out, uint32_t const* r0, uint32_t const* r1, int32_t const* x0, int32_t const* x1, uint16_t const* fx, uint32_t fy, size_t n)
+	{
+		auto const zero = _mm_setzero_si128();
+		auto const wy = _mm_set1_epi16(static_cast<short>(fy));
+
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			auto const wx = _mm_unpacklo_epi64(_mm_set1_epi16(static_cast<short>(fx[i])), _mm_set1_epi16(static_cast<short>(fx[i + 1])));
+			auto const pixels = [&](uint32_t const* r, int32_t const* x)
+			{
+				return _mm_unpacklo_epi8(_mm_set_epi32(0, 0, static_cast<int>(r[x[i + 1]]), static_cast<int>(r[x[i]])), zero);
+			};
+
+			auto const top = lerp_16(pixels(r0, x0), pixels(r0, x1), wx);
+			auto const bottom = lerp_16(pixels(r1, x0), pixels(r1, x1), wx);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lerp_16(top, bottom, wy), zero));
+		}
+		bilinear_span_scalar(out + i, r0, r1, x0 + i, x1 + i, fx + i, fy, n - i);
+	}
+#endif
+
+#if defined(ES_HAS_AVX2_DISPATCH)
+	ES_TARGET_AVX2 inline __m256i blend_16_avx2(__m256i s, __m256i d, __m256i a)
+	{
+		auto const t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(255), a))), _mm256_set1_epi16(128));
+		return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	}
+
+	ES_TARGET_AVX2 inline void blend_span_avx2(uint32_t* d, uint32_t const* s, size_t n, uint32_t ashift)
+	{
+		auto const zero = _mm256_setzero_si256();
+		auto const shift = _mm_cvtsi32_si128(static_cast<int>(ashift));
+		auto const amask = _mm256_set1_epi32(static_cast<int>(0xffu << ashift));
+
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			auto const src = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s + i));
+			auto const dst = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(d + i));
+
+			auto a = _mm256_and_si256(_mm256_srl_epi32(src, shift), _mm256_set1_epi32(0xff));
+			a = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+			a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+
+			// unpack and pack both work within 128 bit lanes, so pixel order survives
+			auto const s1 = _mm256_or_si256(src, amask);
+			auto const lo = blend_16_avx2(_mm256_unpacklo_epi8(s1, zero), _mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(a, zero));
+			auto const hi = blend_16_avx2(_mm256_unpackhi_epi8(s1, zero), _mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(a, zero));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_packus_epi16(lo, hi));
+		}
+		blend_span_sse2(d + i, s + i, n - i, ashift);
+	}
+
+	inline bool cpu_has_avx2()
+	{
+#if defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 0);
+		if (r[0] < 7)
+			return false;
+
+		// the OS must save the YMM registers too
+		__cpuid(r, 1);
+		auto const osxsave_avx = (1 << 27) | (1 << 28);
+		if ((r[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6)
+			return false;
+
+		__cpuidex(r, 7, 0);
+		return (r[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#endif
+
+	using blend_span_fn = void(*)(uint32_t*, uint32_t const*, size_t, uint32_t);
+
+	using bilinear_span_fn = void(*)(uint32_t*, uint32_t const*, uint32_t const*, int32_t const*, int32_t const*, uint16_t const*, uint32_t, size_t);
+
+	using swizzle_span_fn = void(*)(uint32_t*, size_t, swizzle const&);
+
+	// Shift of the alpha byte, or of the unused byte of formats without alpha;
+	// 32 if the channels do not each fill a byte of their own.
+	inline uint32_t byte_channels_ashift(SDL_PixelFormat const* f)
+	{
+		auto const in_byte = [](Uint32 mask, Uint8 shift) { return shift % 8 == 0 && mask == 0xffu << shift; };
+		if (f->BytesPerPixel != 4 || !in_byte(f->Rmask, f->Rshift) || !in_byte(f->Gmask, f->Gshift) || !in_byte(f->Bmask, f->Bshift))
+			return 32;
+		if (f->Amask)
+			return in_byte(f->Amask, f->Ashift) ? f->Ashift : 32;
+
+		return 48u - f->Rshift - f->Gshift - f->Bshift;
+	}
+}
+
+// Scaled blits between 32 bit surfaces, with alpha blending and nearest or
+// bilinear filtering. Rows are fetched into a scratch span and blended with
+// the widest kernel the CPU supports, detected once at startup. When the
+// formats differ but both keep each channel in a byte (e.g. RGBA32 assets
+// onto an ARGB8888 or RGB888 window) the span is swizzled into the
+// destination's layout first. Anything else (other formats, color keys,
+// color or alpha mods, additive blending) is left to SDL_BlitScaled.
+class software_blitter
+{
+public:
+	explicit software_blitter(blit_filter f = blit_filter::nearest)
+		: m_filter{ f }
+	{
+	}
+
+	void set_filter(blit_filter f) noexcept { m_filter = f; }
+
+	blit_filter filter() const noexcept { return m_filter; }
+
+	static bool supports(SDL_Surface* src, SDL_Surface* dst)
+	{
+		if (!src || !dst || src->format->BytesPerPixel != 4)
+			return false;
+		if (src->format->format != dst->format->format && (detail::byte_channels_ashift(src->format) == 32 || detail::byte_channels_ashift(dst->format) == 32))
+			return false;
+
+		SDL_BlendMode mode;
+		Uint8 r, g, b, a;
+		Uint32 key;
+		SDL_GetSurfaceBlendMode(src, &mode);
+		SDL_GetSurfaceColorMod(src, &r, &g, &b);
+		SDL_GetSurfaceAlphaMod(src, &a);
+		if (SDL_GetColorKey(src, &key) == 0 || (r & g & b & a) != 255)
+			return false;
+
+		return mode == SDL_BLENDMODE_NONE || (mode == SDL_BLENDMODE_BLEND && src->format->Amask != 0);
+	}
+
+	// Same contract as SDL_BlitScaled: null rects cover the whole surface.
+	// Returns 0, or SDL_BlitScaled's result when falling back.
+	int blit(SDL_Surface* src, SDL_Rect const* src_rect, SDL_Surface* dst, SDL_Rect const* dest_rect)
+	{
+		if (!supports(src, dst))
+		{
+			auto s = src_rect ? *src_rect : SDL_Rect{ 0, 0, src ? src->w : 0, src ? src->h : 0 };
+			auto d = dest_rect ? *dest_rect : SDL_Rect{ 0, 0, dst ? dst->w : 0, dst ? dst->h : 0 };
+			return SDL_BlitScaled(src, &s, dst, &d);
+		}
+
+		auto const whole_src = SDL_Rect{ 0, 0, src->w, src->h };
+		auto const whole_dst = SDL_Rect{ 0, 0, dst->w, dst->h };
+
+		if (SDL_MUSTLOCK(src) && SDL_LockSurface(src) != 0)
+			return -1;
+		if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) != 0)
+		{
+			if (SDL_MUSTLOCK(src))
+				SDL_UnlockSurface(src);
+			return -1;
+		}
+
+		draw(src, src_rect ? *src_rect : whole_src, dst, dest_rect ? *dest_rect : whole_dst);
+
+		if (SDL_MUSTLOCK(dst))
+			SDL_UnlockSurface(dst);
+		if (SDL_MUSTLOCK(src))
+			SDL_UnlockSurface(src);
+		return 0;
+	}
+
+	// Blits the quads in order and returns the number of failed ones.
+	size_t blit(SDL_Surface* dst, blit_quad const* quads, size_t n)
+	{
+		size_t failed = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			if (blit(quads[i].surface, &quads[i].src, dst, &quads[i].dest) != 0)
+				failed++;
+		}
+		return failed;
+	}
+
+	static bool uses_avx2() { return kernels().avx2; }
+
+private:
+	struct kernel_set
+	{
+		detail::blend_span_fn blend;
+		detail::bilinear_span_fn bilinear;
+		detail::swizzle_span_fn swizzle;
+		bool avx2;
+	};
+
+	static kernel_set const& kernels()
+	{
+		static kernel_set const k = []
+		{
+#if defined(ES_HAS_AVX2_DISPATCH)
+			if (detail::cpu_has_avx2())
+				return kernel_set{ &detail::blend_span_avx2, &detail::bilinear_span_sse2, &detail::swizzle_span_sse2, true };
+#endif
+#if defined(ES_HAS_SSE2)
+			return kernel_set{ &detail::blend_span_sse2, &detail::bilinear_span_sse2, &detail::swizzle_span_sse2, false };
+#else
+			return kernel_set{ &detail::blend_span_scalar, &detail::bilinear_span_scalar, &detail::swizzle_span_scalar, false };
+#endif
+		}();
+		return k;
+	}
+
+	void draw(SDL_Surface* src, SDL_Rect s, SDL_Surface* dst, SDL_Rect d)
+	{
+		auto const whole_src = SDL_Rect{ 0, 0, src->w, src->h };
+		if (!SDL_IntersectRect(&s, &whole_src, &s) || d.w <= 0 || d.h <= 0)
+			return;
+
+		SDL_Rect clip;
+		if (!SDL_IntersectRect(&d, &dst->clip_rect, &clip))
+			return;
+
+		// 16.16 source steps per destination pixel, sampled at pixel centres
+		auto const step_x = (static_cast<int64_t>(s.w) << 16) / d.w;
+		auto const step_y = (static_cast<int64_t>(s.h) << 16) / d.h;
+		auto const bilinear = m_filter == blit_filter::bilinear;
+		auto const offset = bilinear ? -int64_t{ 0x8000 } : int64_t{ 0 };
+
+		auto const n = static_cast<size_t>(clip.w);
+		m_x0.resize(n);
+		m_x1.resize(n);
+		m_fx.resize(n);
+		m_row.resize(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			auto const pos = std::max<int64_t>((clip.x - d.x + static_cast<int64_t>(i)) * step_x + step_x / 2 + offset, 0);
+			m_x0[i] = std::min(s.x + static_cast<int32_t>(pos >> 16), s.x + s.w - 1);
+			m_x1[i] = std::min(m_x0[i] + 1, s.x + s.w - 1);
+			m_fx[i] = static_cast<uint16_t>((pos >> 8) & 0xff);
+		}
+
+		auto const& k = kernels();
+		auto const blend = src->format->Amask != 0 && [&] { SDL_BlendMode m; SDL_GetSurfaceBlendMode(src, &m); return m == SDL_BLENDMODE_BLEND; }();
+		auto const convert = src->format->format != dst->format->format;
+		auto const ashift = convert ? detail::byte_channels_ashift(dst->format) : static_cast<uint32_t>(src->format->Ashift);
+
+		// alpha goes to the destination's alpha or unused byte
+		auto const sw = detail::swizzle{
+			{ src->format->Rshift, src->format->Gshift, src->format->Bshift, detail::byte_channels_ashift(src->format) },
+			{ dst->format->Rshift, dst->format->Gshift, dst->format->Bshift, ashift } };
+
+		for (int y = clip.y; y < clip.y + clip.h; y++)
+		{
+			auto const pos = std::max<int64_t>((y - d.y) * step_y + step_y / 2 + offset, 0);
+			auto const y0 = std::min(s.y + static_cast<int32_t>(pos >> 16), s.y + s.h - 1);
+			auto const out = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(dst->pixels) + y * dst->pitch) + clip.x;
+			auto const r0 = row(src, y0);
+
+			if (bilinear)
+			{
+				auto const r1 = row(src, std::min(y0 + 1, s.y + s.h - 1));
+				k.bilinear(m_row.data(), r0, r1, m_x0.data(), m_x1.data(), m_fx.data(), static_cast<uint32_t>((pos >> 8) & 0xff), n);
+			}
+			else
+			{
+				for (size_t i = 0; i < n; i++)
+					m_row[i] = r0[m_x0[i]];
+			}
+
+			if (convert)
+				k.swizzle(m_row.data(), n, sw);
+
+			if (blend)
+				k.blend(out, m_row.data(), n, ashift);
+			else
+				std::memcpy(out, m_row.data(), n * sizeof(uint32_t));
+		}
+	}
+
+	static uint32_t const* row(SDL_Surface* s, int y)
+	{
+		return reinterpret_cast<uint32_t const*>(static_cast<uint8_t const*>(s->pixels) + y * s->pitch);
+	}
+
+	blit_filter m_filter;
+
+	std::vector<int32_t> m_x0;
+	std::vector<int32_t> m_x1;
+	std::vector<uint16_t> m_fx;
+	std::vector<uint32_t> m_row;
+};
+
+}}
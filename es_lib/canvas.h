@@ -0,0 +1,136 @@
+#pragma once
+
+#include "sdl.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Composites quads on the CPU for renderers without SDL_RenderGeometry.
+// They are blended, nearest sampled from RGBA32 surfaces, into a buffer
+// covering only the area passed to begin(); end() uploads that area into a
+// streaming texture the size of the window and draws it with one copy.
+class streaming_canvas
+{
+public:
+	// Starts a composite of area, clipped to the window. Returns false when
+	// none of it is visible; skip blend() and end() then.
+	bool begin(context& c, SDL_Rect area)
+	{
+		auto const ws = c.get_window_size();
+		if (!m_texture || ws != m_size)
+		{
+			m_texture = c.create_streaming_texture(ws.first, ws.second);
+			m_size = ws;
+		}
+
+		auto const x0 = std::max(area.x, 0);
+		auto const y0 = std::max(area.y, 0);
+		auto const x1 = std::min(area.x + area.w, ws.first);
+		auto const y1 = std::min(area.y + area.h, ws.second);
+		if (x0 >= x1 || y0 >= y1)
+			return false;
+
+		m_box = SDL_Rect{ x0, y0, x1 - x0, y1 - y0 };
+		m_pixels.assign(static_cast<size_t>(m_box.w) * m_box.h * 4, uint8_t{ 0 });
+		return true;
+	}
+
+	// Blends src of an RGBA32 surface over dest, modulated by tint.
+	void blend(SDL_Surface const& s, SDL_Rect src, SDL_Rect dest, SDL_Color tint = SDL_Color{ 255, 255, 255, 255 })
+	{
+		if (dest.w <= 0 || dest.h <= 0 || src.w <= 0 || src.h <= 0)
+			return;
+
+		auto const px0 = std::max(dest.x, m_box.x);
+		auto const px1 = std::min(dest.x + dest.w, m_box.x + m_box.w);
+		auto const py0 = std::max(dest.y, m_box.y);
+		auto const py1 = std::min(dest.y + dest.h, m_box.y + m_box.h);
+		if (px0 >= px1 || py0 >= py1)
+			return;
+
+		auto const untinted = tint.r == 255 && tint.g == 255 && tint.b == 255;
+
+		// 16.16 source column per destination pixel
+		auto const step_x = (static_cast<int64_t>(src.w) << 16) / dest.w;
+		for (auto py = py0; py < py1; py++)
+		{
+			auto const sy = src.y + (py - dest.y) * src.h / dest.h;
+			auto const row = static_cast<uint8_t const*>(s.pixels) + sy * s.pitch + src.x * 4;
+			auto out = m_pixels.data() + ((static_cast<size_t>(py - m_box.y) * m_box.w) + (px0 - m_box.x)) * 4;
+			auto sx = (px0 - dest.x) * step_x;
+			for (auto px = px0; px < px1; px++, out += 4, sx += step_x)
+			{
+				auto const in = row + (sx >> 16) * 4;
+				auto const a = tint.a == 255 ? uint32_t{ in[3] } : detail::div255(in[3] * uint32_t{ tint.a });
+				if (!a)
+					continue;
+
+				// opaque untinted texels replace what is below
+				if (a == 255 && untinted)
+				{
+					std::memcpy(out, in, 4);
+					continue;
+				}
+
+				auto const inv = 255 - a;
+				auto const r = untinted ? uint32_t{ in[0] } : detail::div255(in[0] * uint32_t{ tint.r });
+				auto const g = untinted ? uint32_t{ in[1] } : detail::div255(in[1] * uint32_t{ tint.g });
+				auto const b = untinted ? uint32_t{ in[2] } : detail::div255(in[2] * uint32_t{ tint.b });
+				out[0] = static_cast<uint8_t>(detail::div255(r * a) + detail::div255(out[0] * inv));
+				out[1] = static_cast<uint8_t>(detail::div255(g * a) + detail::div255(out[1] * inv));
+				out[2] = static_cast<uint8_t>(detail::div255(b * a) + detail::div255(out[2] * inv));
+				out[3] = static_cast<uint8_t>(a + detail::div255(out[3] * inv));
+			}
+		}
+	}
+
+	// Uploads the composited area and draws it.
+	void end(context& c)
+	{
+		// back to straight alpha for SDL_BLENDMODE_BLEND
+		void* pixels;
+		int pitch;
+		if (SDL_LockTexture(m_texture.get(), &m_box, &pixels, &pitch) != 0)
+		{
+			printf("Fail | SDL_LockTexture -> %s\n", SDL_GetError());
+			return;
+		}
+		for (int y = 0; y < m_box.h; y++)
+		{
+			auto in = m_pixels.data() + static_cast<size_t>(y) * m_box.w * 4;
+			auto out = static_cast<uint8_t*>(pixels) + y * pitch;
+			for (int x = 0; x < m_box.w; x++, in += 4, out += 4)
+			{
+				auto const a = uint32_t{ in[3] };
+				if (a == 255 || !a)
+				{
+					std::memcpy(out, in, 4);
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+					out[k] = static_cast<uint8_t>(std::min<uint32_t>(255, (in[k] * 255 + a / 2) / a));
+				out[3] = in[3];
+			}
+		}
+		SDL_UnlockTexture(m_texture.get());
+
+		auto src = m_box;
+		auto dest = m_box;
+		c.render_copy(*m_texture, &src, &dest);
+	}
+
+private:
+	texture_t m_texture;
+
+	std::pair<int, int> m_size{ 0, 0 };
+
+	SDL_Rect m_box{ 0, 0, 0, 0 };
+
+	// premultiplied RGBA bytes of m_box
+	std::vector<uint8_t> m_pixels;
+};
+
+}}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "sdl.h"
+#include "tile_map.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+namespace es { namespace sdl {
+
+struct aabb
+{
+	vecf min;
+	vecf max;
+};
+
+inline aabb bounds_of(moveable_object const& o)
+{
+	return aabb{ o.position, vecf{ o.position.x + o.size.x, o.position.y + o.size.y } };
+}
+
+inline bool overlaps(aabb const& a, aabb const& b)
+{
+	return a.min.x < b.max.x && b.min.x < a.max.x && a.min.y < b.max.y && b.min.y < a.max.y;
+}
+
+// Boxes touching a tile edge exactly do not overlap it.
+constexpr static auto contact_epsilon = 1e-4f;
+
+// Tiles touched by a box, as a half-open rectangle.
+inline SDL_Rect covered_tiles(aabb const& box)
+{
+	auto const x0 = static_cast<int>(std::floor(box.min.x + contact_epsilon));
+	auto const y0 = static_cast<int>(std::floor(box.min.y + contact_epsilon));
+	auto const x1 = static_cast<int>(std::ceil(box.max.x - contact_epsilon));
+	auto const y1 = static_cast<int>(std::ceil(box.max.y - contact_epsilon));
+	return SDL_Rect{ x0, y0, x1 - x0, y1 - y0 };
+}
+
+// Calls fn(x, y, physical) for every tile with a non-zero physical id under
+// the box. Only the overlapped tiles are sampled.
+template <typename Fn>
+void for_each_solid_tile(tile_map const& map, aabb const& box, Fn&& fn)
+{
+	auto const r = covered_tiles(box);
+	for (int y = r.y; y < r.y + r.h; y++)
+	{
+		for (int x = r.x; x < r.x + r.w; x++)
+		{
+			if (auto const physical = map.physical_at(x, y))
+				fn(x, y, physical);
+		}
+	}
+}
+
+enum contact : uint32_t
+{
+	contact_none	= 0,
+	contact_left	= 1 << 0,
+	contact_right	= 1 << 1,
+	contact_top		= 1 << 2,
+	contact_bottom	= 1 << 3,
+};
+
+// Integrates the object over dt seconds and pushes it out of solid tiles,
+// resolving one axis at a time. The move is split into steps of at most half
+// a tile so fast objects cannot tunnel through thin walls. Returns the
+// contact flags of the sides that hit something.
+inline uint32_t move_and_collide(moveable_object& o, tile_map const& map, float dt)
+{
+	o.velocity.x += o.acceleration.x * dt;
+	o.velocity.y += o.acceleration.y * dt;
+
+	auto const distance = std::max(std::abs(o.velocity.x), std::abs(o.velocity.y)) * dt;
+	auto const steps = std::max(1, static_cast<int>(std::ceil(distance / 0.5f)));
+	auto const step = dt / steps;
+
+	uint32_t contacts = contact_none;
+	for (int i = 0; i < steps; i++)
+	{
+		if (o.velocity.x != 0.0f)
+		{
+			o.position.x += o.velocity.x * step;
+			auto const moving_right = o.velocity.x > 0.0f;
+			auto hit = false;
+			auto limit = moving_right ? o.position.x + o.size.x : o.position.x;
+			for_each_solid_tile(map, bounds_of(o), [&](int x, int, uint32_t)
+			{
+				hit = true;
+				limit = moving_right ? std::min(limit, static_cast<float>(x)) : std::max(limit, static_cast<float>(x + 1));
+			});
+			if (hit)
+			{
+				o.position.x = moving_right ? limit - o.size.x : limit;
+				o.velocity.x = 0.0f;
+				contacts |= moving_right ? contact_right : contact_left;
+			}
+		}
+
+		if (o.velocity.y != 0.0f)
+		{
+			o.position.y += o.velocity.y * step;
+			auto const moving_down = o.velocity.y > 0.0f;
+			auto hit = false;
+			auto limit = moving_down ? o.position.y + o.size.y : o.position.y;
+			for_each_solid_tile(map, bounds_of(o), [&](int, int y, uint32_t)
+			{
+				hit = true;
+				limit = moving_down ? std::min(limit, static_cast<float>(y)) : std::max(limit, static_cast<float>(y + 1));
+			});
+			if (hit)
+			{
+				o.position.y = moving_down ? limit - o.size.y : limit;
+				o.velocity.y = 0.0f;
+				contacts |= moving_down ? contact_bottom : contact_top;
+			}
+		}
+	}
+	return contacts;
+}
+
+// True when a solid tile lies directly below the object.
+inline bool on_ground(moveable_object const& o, tile_map const& map)
+{
+	auto probe = bounds_of(o);
+	probe.min.y = probe.max.y;
+	probe.max.y += 2 * contact_epsilon;
+
+	auto found = false;
+	for_each_solid_tile(map, probe, [&](int, int, uint32_t) { found = true; });
+	return found;
+}
+
+// Uniform grid broadphase for sprite-vs-sprite contacts. Objects are
+// identified by small dense ids (e.g. entity indices). update() only touches
+// the grid when an object's covered cells change, so moving objects inside a
+// cell cost nothing beyond storing the new box.
+class spatial_hash
+{
+public:
+	explicit spatial_hash(float cell_size = 4.0f)
+		: m_cell_size{ cell_size }
+	{
+		assert(cell_size > 0.0f);
+	}
+
+	void update(uint32_t id, aabb const& box)
+	{
+		if (id >= m_entries.size())
+			m_entries.resize(id + 1);
+
+		auto& e = m_entries[id];
+		auto const r = cells_of(box);
+		e.box = box;
+
+		if (e.live && same(e.cells, r))
+			return;
+
+		if (e.live)
+			unlink(id, e.cells);
+
+		e.cells = r;
+		e.live = true;
+		for_each_cell(r, [&](int x, int y) { m_cells[key(x, y)].push_back(id); });
+	}
+
+	void remove(uint32_t id)
+	{
+		if (id >= m_entries.size() || !m_entries[id].live)
+			return;
+
+		unlink(id, m_entries[id].cells);
+		m_entries[id].live = false;
+	}
+
+	// Calls fn(id) once for every object whose box overlaps the given one.
+	template <typename Fn>
+	void query(aabb const& box, Fn&& fn)
+	{
+		m_stamp++;
+		if (m_stamps.size() < m_entries.size())
+			m_stamps.resize(m_entries.size(), 0);
+
+		for_each_cell(cells_of(box), [&](int x, int y)
+		{
+			auto const it = m_cells.find(key(x, y));
+			if (it == m_cells.end())
+				return;
+
+			for (auto const id : it->second)
+			{
+				if (m_stamps[id] != m_stamp && overlaps(box, m_entries[id].box))
+				{
+					m_stamps[id] = m_stamp;
+					fn(id);
+				}
+			}
+		});
+	}
+
+	// Calls fn(a, b) once for every pair of overlapping objects. A pair is
+	// reported only from the first cell the two objects share.
+	template <typename Fn>
+	void for_each_pair(Fn&& fn) const
+	{
+		for (auto const& cell : m_cells)
+		{
+			auto const& ids = cell.second;
+			auto const cx = static_cast<int32_t>(cell.first >> 32);
+			auto const cy = static_cast<int32_t>(cell.first);
+
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				auto const& a = m_entries[ids[i]];
+				for (size_t j = i + 1; j < ids.size(); j++)
+				{
+					auto const& b = m_entries[ids[j]];
+					if (std::max(a.cells.x, b.cells.x) != cx || std::max(a.cells.y, b.cells.y) != cy)
+						continue;
+
+					if (overlaps(a.box, b.box))
+						fn(ids[i], ids[j]);
+				}
+			}
+		}
+	}
+
+	void clear()
+	{
+		m_cells.clear();
+		m_entries.clear();
+	}
+
+private:
+	struct entry
+	{
+		aabb box;
+		SDL_Rect cells;
+		bool live;
+	};
+
+	static uint64_t key(int x, int y) noexcept
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+	}
+
+	static bool same(SDL_Rect const& a, SDL_Rect const& b) noexcept
+	{
+		return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+	}
+
+	template <typename Fn>
+	static void for_each_cell(SDL_Rect const& r, Fn&& fn)
+	{
+		for (int y = r.y; y < r.y + r.h; y++)
+			for (int x = r.x; x < r.x + r.w; x++)
+				fn(x, y);
+	}
+
+	SDL_Rect cells_of(aabb const& box) const
+	{
+		auto const x0 = static_cast<int>(std::floor(box.min.x / m_cell_size));
+		auto const y0 = static_cast<int>(std::floor(box.min.y / m_cell_size));
+		auto const x1 = static_cast<int>(std::floor(box.max.x / m_cell_size));
+		auto const y1 = static_cast<int>(std::floor(box.max.y / m_cell_size));
+		return SDL_Rect{ x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+	}
+
+	void unlink(uint32_t id, SDL_Rect const& r)
+	{
+		for_each_cell(r, [&](int x, int y)
+		{
+			auto& ids = m_cells[key(x, y)];
+			auto const it = std::find(ids.begin(), ids.end(), id);
+			if (it != ids.end())
+			{
+				*it = ids.back();
+				ids.pop_back();
+			}
+		});
+	}
+
+	float m_cell_size;
+
+	// Empty cells are kept so that objects moving back and forth reuse the
+	// allocation.
+	std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells;
+
+	std::vector<entry> m_entries;
+
+	std::vector<uint32_t> m_stamps;
+
+	uint32_t m_stamp = 0;
+};
+
+}}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "sdl.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace es { namespace sdl {
+
+struct render_command
+{
+	uint64_t sort_key;		// layer << 32 | record order
+	SDL_Texture* texture;	// nullptr fills dest with color
+	SDL_Rect src;			// zero size copies the whole texture
+	SDL_Rect dest;
+	SDL_Color color;
+
+	uint32_t layer() const noexcept { return static_cast<uint32_t>(sort_key >> 32); }
+};
+
+// What recording reads from the context, copied out on the thread that owns
+// the context so the recording thread never calls into SDL.
+struct record_target
+{
+	std::pair<int, int> window_size;
+
+	// by visual id
+	std::vector<SDL_Texture*> textures;
+
+	// drawn for visuals without a texture
+	SDL_Texture* placeholder = nullptr;
+
+	SDL_Texture* texture(uint32_t visual) const { return visual < textures.size() ? textures[visual] : placeholder; }
+};
+
+// Call before handing target to the recording thread, and again whenever
+// textures were added or removed.
+inline void resolve(context const& c, record_target& target)
+{
+	target.window_size = c.get_window_size();
+	c.resources().resolve_textures(target.textures);
+	target.placeholder = c.resources().placeholder();
+}
+
+// A frame's draws recorded as plain data so they can be produced away from
+// the thread that owns the renderer. Any number of threads may record at
+// once; slots are claimed with a single atomic increment. Commands recorded
+// past the capacity take a lock and wait in an overflow list until sort(),
+// and clear() grows the storage so the next frame fits.
+class command_buffer
+{
+public:
+	explicit command_buffer(size_t capacity = 4096)
+		: m_commands(capacity)
+	{
+	}
+
+	command_buffer(command_buffer const&) = delete;
+	command_buffer& operator=(command_buffer const&) = delete;
+
+	void record(SDL_Texture& t, SDL_Rect const* src, SDL_Rect const& dest, uint32_t layer = 0)
+	{
+		push(&t, src ? *src : SDL_Rect{ 0, 0, 0, 0 }, dest, SDL_Color{ 0, 0, 0, 0 }, layer);
+	}
+
+	void record(SDL_Rect const& dest, SDL_Color c, uint32_t layer = 0)
+	{
+		push(nullptr, SDL_Rect{ 0, 0, 0, 0 }, dest, c, layer);
+	}
+
+	// Includes commands in the overflow list.
+	size_t size() const noexcept { return m_count.load(std::memory_order_acquire); }
+
+	bool empty() const noexcept { return size() == 0; }
+
+	size_t capacity() const noexcept { return m_commands.size(); }
+
+	// Commands recorded past the capacity since the last sort().
+	size_t overflowed() const
+	{
+		std::lock_guard<std::mutex> lock{ m_overflow_mutex };
+		return m_overflow.size();
+	}
+
+	// Only covers the overflow list after sort().
+	render_command const* begin() const noexcept { return m_commands.data(); }
+
+	render_command const* end() const noexcept { return m_commands.data() + std::min(size(), m_commands.size()); }
+
+	// Orders the commands by layer, then texture. Commands on the same layer
+	// and texture keep the order they were recorded in. Not safe while other
+	// threads are recording.
+	void sort()
+	{
+		merge_overflow();
+		std::sort(m_commands.begin(), m_commands.begin() + size(), [](render_command const& a, render_command const& b)
+		{
+			if (a.layer() != b.layer())
+				return a.layer() < b.layer();
+			if (a.texture != b.texture)
+				return std::less<SDL_Texture*>{}(a.texture, b.texture);
+			return a.sort_key < b.sort_key;
+		});
+	}
+
+	// Sorts and submits the commands to the renderer. Must be called from the
+	// thread that owns the context while nobody is recording.
+	void replay(context& c)
+	{
+		sort();
+		for (auto it = m_commands.begin(), last = m_commands.begin() + size(); it != last; ++it)
+		{
+			auto dest = it->dest;
+			if (!it->texture)
+			{
+				c.fill_rect(dest, it->color);
+				continue;
+			}
+
+			auto src = it->src;
+			c.render_copy(*it->texture, src.w ? &src : nullptr, &dest);
+		}
+	}
+
+	// Empties the buffer for the next frame, growing it if commands
+	// overflowed.
+	void clear()
+	{
+		auto const count = m_count.load(std::memory_order_acquire);
+		if (count > m_commands.size())
+		{
+			auto n = m_commands.size() ? m_commands.size() : 1;
+			while (n < count) n <<= 1;
+			reserve(n);
+		}
+		{
+			std::lock_guard<std::mutex> lock{ m_overflow_mutex };
+			m_overflow.clear();
+		}
+		m_count.store(0, std::memory_order_release);
+	}
+
+	// Not safe while other threads are recording.
+	void reserve(size_t n)
+	{
+		if (n > m_commands.size())
+			m_commands.resize(n);
+	}
+
+private:
+	void push(SDL_Texture* t, SDL_Rect src, SDL_Rect dest, SDL_Color c, uint32_t layer)
+	{
+		auto const i = m_count.fetch_add(1, std::memory_order_relaxed);
+		auto const command = render_command{ (static_cast<uint64_t>(layer) << 32) | static_cast<uint32_t>(i), t, src, dest, c };
+		if (i < m_commands.size())
+		{
+			m_commands[i] = command;
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock{ m_overflow_mutex };
+		m_overflow.push_back(command);
+	}
+
+	// Moves overflowed commands to the slot they claimed.
+	void merge_overflow()
+	{
+		std::lock_guard<std::mutex> lock{ m_overflow_mutex };
+		if (m_overflow.empty())
+			return;
+
+		m_commands.resize(m_count.load(std::memory_order_acquire));
+		for (auto const& command : m_overflow)
+		{
+			m_commands[static_cast<uint32_t>(command.sort_key)] = command;
+		}
+		m_overflow.clear();
+	}
+
+	std::vector<render_command> m_commands;
+
+	std::atomic<size_t> m_count{ 0 };
+
+	mutable std::mutex m_overflow_mutex;
+
+	std::vector<render_command> m_overflow;
+};
+
+// Two command buffers: the simulation records frame N+1 into back() while
+// the render thread replays frame N from front(). Call swap() once both
+// sides are done with the frame.
+class render_pipeline
+{
+public:
+	explicit render_pipeline(size_t capacity = 4096)
+	{
+		m_buffers[0].reserve(capacity);
+		m_buffers[1].reserve(capacity);
+	}
+
+	command_buffer& back() noexcept { return m_buffers[m_back]; }
+
+	command_buffer& front() noexcept { return m_buffers[m_back ^ 1]; }
+
+	void swap()
+	{
+		m_back ^= 1;
+		back().clear();
+	}
+
+private:
+	command_buffer m_buffers[2];
+
+	size_t m_back = 0;
+};
+
+}}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "sdl.h"
+#include "job_system.h"
+#include "snapshot.h"
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#ifndef ES_HAS_SSE2
+#define ES_HAS_SSE2 1
+#endif
+#include <emmintrin.h>
+#endif
+
+namespace es { namespace sdl {
+
+// Refers to an entity independently of where its data currently lives.
+// Handles to destroyed entities are detected through the generation.
+struct entity_handle
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+inline bool operator==(entity_handle a, entity_handle b) { return a.index == b.index && a.generation == b.generation; }
+
+inline bool operator!=(entity_handle a, entity_handle b) { return !(a == b); }
+
+namespace detail
+{
+	// v += a * dt; p += v * dt over n floats.
+	inline void integrate_axis_sse2(float* p, float* v, float const* a, size_t n, float dt)
+	{
+		size_t i = 0;
+#if defined(ES_HAS_SSE2)
+		auto const dt4 = _mm_set1_ps(dt);
+		for (; i + 4 <= n; i += 4)
+		{
+			auto const vel = _mm_add_ps(_mm_loadu_ps(v + i), _mm_mul_ps(_mm_loadu_ps(a + i), dt4));
+			_mm_storeu_ps(v + i, vel);
+			_mm_storeu_ps(p + i, _mm_add_ps(_mm_loadu_ps(p + i), _mm_mul_ps(vel, dt4)));
+		}
+#endif
+		for (; i < n; i++)
+		{
+			v[i] += a[i] * dt;
+			p[i] += v[i] * dt;
+		}
+	}
+
+#if defined(ES_HAS_AVX2_DISPATCH)
+	// Same results as the SSE2 kernel: no fused multiply-add either way.
+	ES_TARGET_AVX2 inline void integrate_axis_avx2(float* p, float* v, float const* a, size_t n, float dt)
+	{
+		size_t i = 0;
+		auto const dt8 = _mm256_set1_ps(dt);
+		for (; i + 8 <= n; i += 8)
+		{
+			auto const vel = _mm256_add_ps(_mm256_loadu_ps(v + i), _mm256_mul_ps(_mm256_loadu_ps(a + i), dt8));
+			_mm256_storeu_ps(v + i, vel);
+			_mm256_storeu_ps(p + i, _mm256_add_ps(_mm256_loadu_ps(p + i), _mm256_mul_ps(vel, dt8)));
+		}
+		integrate_axis_sse2(p + i, v + i, a + i, n - i, dt);
+	}
+#endif
+
+	using integrate_axis_fn = void(*)(float*, float*, float const*, size_t, float);
+
+	// The widest kernel the CPU supports, detected once.
+	inline integrate_axis_fn integrate_axis_kernel()
+	{
+		static integrate_axis_fn const k = []
+		{
+#if defined(ES_HAS_AVX2_DISPATCH)
+			if (cpu_has_avx2())
+				return &integrate_axis_avx2;
+#endif
+			return &integrate_axis_sse2;
+		}();
+		return k;
+	}
+
+	inline void integrate_axis(float* p, float* v, float const* a, size_t n, float dt)
+	{
+		integrate_axis_kernel()(p, v, a, n, dt);
+	}
+}
+
+// Structure-of-arrays storage for moving sprites. Every component lives in
+// its own contiguous array indexed by a dense index; destroying an entity
+// moves the last one into its place, so the arrays never have holes and
+// dense indices change. Handles stay valid across such moves.
+class entity_store
+{
+public:
+	entity_handle create(sprite const& s)
+	{
+		uint32_t slot;
+		if (m_free_slots.empty())
+		{
+			slot = static_cast<uint32_t>(m_slots.size());
+			m_slots.push_back(slot_t{ 0, 0 });
+		}
+		else
+		{
+			slot = m_free_slots.back();
+			m_free_slots.pop_back();
+		}
+
+		auto const dense = static_cast<uint32_t>(size());
+		m_slots[slot].dense = dense;
+		m_slot_of.push_back(slot);
+
+		m_position_x.push_back(s.position.x);
+		m_position_y.push_back(s.position.y);
+		m_velocity_x.push_back(s.velocity.x);
+		m_velocity_y.push_back(s.velocity.y);
+		m_acceleration_x.push_back(s.acceleration.x);
+		m_acceleration_y.push_back(s.acceleration.y);
+		m_size_x.push_back(s.size.x);
+		m_size_y.push_back(s.size.y);
+		m_visual.push_back(s.visual);
+		m_physical.push_back(s.physical);
+
+		return entity_handle{ slot, m_slots[slot].generation };
+	}
+
+	void destroy(entity_handle h)
+	{
+		assert(alive(h));
+
+		auto const dense = m_slots[h.index].dense;
+		auto const last = static_cast<uint32_t>(size() - 1);
+		if (dense != last)
+		{
+			move_component(dense, last);
+			m_slot_of[dense] = m_slot_of[last];
+			m_slots[m_slot_of[dense]].dense = dense;
+		}
+		pop_back();
+
+		m_slots[h.index].generation++;
+		m_free_slots.push_back(h.index);
+	}
+
+	bool alive(entity_handle h) const noexcept
+	{
+		return h.index < m_slots.size() && m_slots[h.index].generation == h.generation;
+	}
+
+	size_t size() const noexcept { return m_position_x.size(); }
+
+	bool empty() const noexcept { return m_position_x.empty(); }
+
+	// Current position of the entity in the component arrays.
+	uint32_t dense_index(entity_handle h) const
+	{
+		assert(alive(h));
+		return m_slots[h.index].dense;
+	}
+
+	entity_handle handle_at(uint32_t dense) const
+	{
+		auto const slot = m_slot_of[dense];
+		return entity_handle{ slot, m_slots[slot].generation };
+	}
+
+	sprite get(uint32_t dense) const
+	{
+		sprite s;
+		s.position = vecf{ m_position_x[dense], m_position_y[dense] };
+		s.velocity = vecf{ m_velocity_x[dense], m_velocity_y[dense] };
+		s.acceleration = vecf{ m_acceleration_x[dense], m_acceleration_y[dense] };
+		s.size = vecf{ m_size_x[dense], m_size_y[dense] };
+		s.visual = m_visual[dense];
+		s.physical = m_physical[dense];
+		return s;
+	}
+
+	void set(uint32_t dense, sprite const& s)
+	{
+		m_position_x[dense] = s.position.x;
+		m_position_y[dense] = s.position.y;
+		m_velocity_x[dense] = s.velocity.x;
+		m_velocity_y[dense] = s.velocity.y;
+		m_acceleration_x[dense] = s.acceleration.x;
+		m_acceleration_y[dense] = s.acceleration.y;
+		m_size_x[dense] = s.size.x;
+		m_size_y[dense] = s.size.y;
+		m_visual[dense] = s.visual;
+		m_physical[dense] = s.physical;
+	}
+
+	// Semi-implicit Euler step of dt seconds for the dense range [first, last),
+	// matching integrate(moveable_object&, float). Disjoint ranges may be
+	// integrated concurrently.
+	void integrate(size_t first, size_t last, float dt)
+	{
+		assert(first <= last && last <= size());
+		auto const n = last - first;
+		detail::integrate_axis(m_position_x.data() + first, m_velocity_x.data() + first, m_acceleration_x.data() + first, n, dt);
+		detail::integrate_axis(m_position_y.data() + first, m_velocity_y.data() + first, m_acceleration_y.data() + first, n, dt);
+	}
+
+	void integrate(float dt) { integrate(0, size(), dt); }
+
+	// Splits the integration across the job system's threads.
+	void integrate(job_system& jobs, float dt, size_t grain = 8192)
+	{
+		jobs.parallel_for(0, size(), grain, [this, dt](size_t first, size_t last) { integrate(first, last, dt); });
+	}
+
+	float* position_x() noexcept { return m_position_x.data(); }
+	float* position_y() noexcept { return m_position_y.data(); }
+	float* velocity_x() noexcept { return m_velocity_x.data(); }
+	float* velocity_y() noexcept { return m_velocity_y.data(); }
+	float* acceleration_x() noexcept { return m_acceleration_x.data(); }
+	float* acceleration_y() noexcept { return m_acceleration_y.data(); }
+	float* size_x() noexcept { return m_size_x.data(); }
+	float* size_y() noexcept { return m_size_y.data(); }
+	int32_t* visual() noexcept { return m_visual.data(); }
+	int32_t* physical() noexcept { return m_physical.data(); }
+
+	float const* position_x() const noexcept { return m_position_x.data(); }
+	float const* position_y() const noexcept { return m_position_y.data(); }
+	float const* velocity_x() const noexcept { return m_velocity_x.data(); }
+	float const* velocity_y() const noexcept { return m_velocity_y.data(); }
+	float const* acceleration_x() const noexcept { return m_acceleration_x.data(); }
+	float const* acceleration_y() const noexcept { return m_acceleration_y.data(); }
+	float const* size_x() const noexcept { return m_size_x.data(); }
+	float const* size_y() const noexcept { return m_size_y.data(); }
+	int32_t const* visual() const noexcept { return m_visual.data(); }
+	int32_t const* physical() const noexcept { return m_physical.data(); }
+
+	void reserve(size_t n)
+	{
+		for_each_array([n](auto& a) { a.reserve(n); });
+		m_slot_of.reserve(n);
+	}
+
+	// Writes the components together with the handle table, so handles
+	// taken before a save are valid again after the matching load.
+	void save(snapshot_writer& w) const
+	{
+		w.write_vector(m_slots);
+		w.write_vector(m_free_slots);
+		w.write_vector(m_slot_of);
+		for_each_array([&w](auto const& a) { w.write_vector(a); });
+	}
+
+	// Replaces the whole store. Arrays only reallocate when they have to
+	// grow; on failure the store is left empty.
+	bool load(snapshot_reader& r)
+	{
+		auto ok = r.read_vector(m_slots) && r.read_vector(m_free_slots) && r.read_vector(m_slot_of);
+		for_each_array([&](auto& a) { ok = ok && r.read_vector(a) && a.size() == m_slot_of.size(); });
+		for (size_t i = 0; ok && i < m_slot_of.size(); i++)
+		{
+			ok = m_slot_of[i] < m_slots.size() && m_slots[m_slot_of[i]].dense == i;
+		}
+		for (auto const s : m_free_slots)
+		{
+			ok = ok && s < m_slots.size();
+		}
+
+		if (!ok)
+		{
+			m_slots.clear();
+			m_free_slots.clear();
+			m_slot_of.clear();
+			for_each_array([](auto& a) { a.clear(); });
+			return r.fail();
+		}
+		return true;
+	}
+
+private:
+	struct slot_t
+	{
+		uint32_t dense;
+		uint32_t generation;
+	};
+
+	template <typename Fn>
+	void for_each_array(Fn&& fn)
+	{
+		fn(m_position_x); fn(m_position_y);
+		fn(m_velocity_x); fn(m_velocity_y);
+		fn(m_acceleration_x); fn(m_acceleration_y);
+		fn(m_size_x); fn(m_size_y);
+		fn(m_visual); fn(m_physical);
+	}
+
+	template <typename Fn>
+	void for_each_array(Fn&& fn) const
+	{
+		fn(m_position_x); fn(m_position_y);
+		fn(m_velocity_x); fn(m_velocity_y);
+		fn(m_acceleration_x); fn(m_acceleration_y);
+		fn(m_size_x); fn(m_size_y);
+		fn(m_visual); fn(m_physical);
+	}
+
+	void move_component(uint32_t to, uint32_t from)
+	{
+		for_each_array([to, from](auto& a) { a[to] = a[from]; });
+	}
+
+	void pop_back()
+	{
+		for_each_array([](auto& a) { a.pop_back(); });
+		m_slot_of.pop_back();
+	}
+
+	std::vector<slot_t> m_slots;
+
+	std::vector<uint32_t> m_free_slots;
+
+	// dense index -> slot
+	std::vector<uint32_t> m_slot_of;
+
+	std::vector<float> m_position_x;
+	std::vector<float> m_position_y;
+	std::vector<float> m_velocity_x;
+	std::vector<float> m_velocity_y;
+	std::vector<float> m_acceleration_x;
+	std::vector<float> m_acceleration_y;
+	std::vector<float> m_size_x;
+	std::vector<float> m_size_y;
+	std::vector<int32_t> m_visual;
+	std::vector<int32_t> m_physical;
+};
+
+}}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "sdl.h"
+#include <algorithm>
+#include <chrono>
+
+namespace es { namespace sdl {
+
+// Decides how many fixed simulation ticks are due each rendered frame, so
+// that the simulation speed does not depend on the frame rate.
+//
+//	fixed_step step{ 60 };
+//	while (running)
+//	{
+//		for (auto n = step.advance(); n; n--) update(step.dt());
+//		draw(step.alpha());
+//	}
+class fixed_step
+{
+public:
+	using clock_t = std::chrono::steady_clock;
+
+	// When rendering falls behind by more than max_ticks_per_frame ticks the
+	// remaining backlog is dropped, slowing the simulation down rather than
+	// letting the catch-up work grow without bound.
+	explicit fixed_step(uint32_t ticks_per_second = 60, uint32_t max_ticks_per_frame = 5)
+		: m_tick{ std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(1.0 / ticks_per_second)) }
+		, m_max_ticks_per_frame{ max_ticks_per_frame }
+	{
+		assert(ticks_per_second && max_ticks_per_frame);
+	}
+
+	// Returns the number of ticks to simulate for the time elapsed since the
+	// previous call. The first call only starts the clock.
+	uint32_t advance(clock_t::time_point now)
+	{
+		if (!m_started)
+		{
+			m_started = true;
+			m_previous = now;
+			return 0;
+		}
+
+		auto const elapsed = now - m_previous;
+		m_previous = now;
+		m_accumulator += std::chrono::duration_cast<clock_t::duration>(elapsed * m_time_scale);
+
+		auto due = static_cast<uint32_t>(m_accumulator / m_tick);
+		if (due > m_max_ticks_per_frame)
+		{
+			due = m_max_ticks_per_frame;
+			m_accumulator = m_tick * due;
+			m_dropped_frames++;
+		}
+		m_accumulator -= m_tick * due;
+		m_ticks += due;
+		return due;
+	}
+
+	uint32_t advance() { return advance(clock_t::now()); }
+
+	// Seconds of simulated time per tick.
+	float dt() const noexcept { return std::chrono::duration<float>(m_tick).count(); }
+
+	// How far the current time lies between the last two ticks, in [0, 1).
+	float alpha() const noexcept
+	{
+		return std::min(std::chrono::duration<float>(m_accumulator).count() / dt(), 1.0f);
+	}
+
+	// Scales simulated time against wall time; values above 1 run the
+	// simulation faster than real time.
+	void set_time_scale(double s) noexcept { m_time_scale = s; }
+
+	uint64_t ticks() const noexcept { return m_ticks; }
+
+	// Number of frames in which the catch-up limit discarded time.
+	uint64_t dropped_frames() const noexcept { return m_dropped_frames; }
+
+private:
+	clock_t::duration m_tick;
+
+	uint32_t m_max_ticks_per_frame;
+
+	clock_t::duration m_accumulator{ 0 };
+
+	clock_t::time_point m_previous;
+
+	bool m_started = false;
+
+	double m_time_scale = 1.0;
+
+	uint64_t m_ticks = 0;
+
+	uint64_t m_dropped_frames = 0;
+};
+
+// Semi-implicit Euler step of dt seconds.
+inline void integrate(moveable_object& o, float dt)
+{
+	o.velocity.x += o.acceleration.x * dt;
+	o.velocity.y += o.acceleration.y * dt;
+	o.position.x += o.velocity.x * dt;
+	o.position.y += o.velocity.y * dt;
+}
+
+inline vecf lerp(vecf a, vecf b, float t)
+{
+	return vecf{ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+}
+
+// The state to draw for a frame that falls alpha of the way between the
+// previous and the current tick.
+inline sprite interpolate(sprite const& previous, sprite const& current, float alpha)
+{
+	auto s = current;
+	s.position = lerp(previous.position, current.position, alpha);
+	return s;
+}
+
+}}
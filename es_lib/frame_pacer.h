@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace es { namespace sdl {
+
+enum class pacing_mode
+{
+	vsync,		// SDL_RenderPresent blocks on the display; no extra waiting
+	fixed_rate,	// wait for a fixed frame interval
+	uncapped,	// present as fast as possible
+};
+
+// Waits for frame deadlines in fixed_rate mode. The OS usually wakes a
+// sleeping thread late, so the pacer sleeps until a margin before the
+// deadline and yields for the rest. The margin follows the 95th percentile
+// of recently measured oversleep, so it shrinks on precise schedulers and
+// grows where wake-ups are late.
+class frame_pacer
+{
+public:
+	using clock_t = std::chrono::steady_clock;
+
+	void set_mode(pacing_mode m) noexcept { m_mode = m; }
+
+	pacing_mode mode() const noexcept { return m_mode; }
+
+	void set_frames_per_second(uint32_t f) noexcept
+	{
+		if (f)
+			m_interval = std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(1.0 / f));
+	}
+
+	clock_t::duration frame_interval() const noexcept { return m_interval; }
+
+	float frames_per_second() const noexcept { return 1.0f / std::chrono::duration<float>(m_interval).count(); }
+
+	// Blocks until the next frame is due. Deadlines advance by whole
+	// intervals so small errors do not accumulate; after a missed deadline
+	// the schedule restarts from now instead of rushing to catch up.
+	void wait_for_frame()
+	{
+		if (m_mode != pacing_mode::fixed_rate)
+			return;
+
+		auto const now = clock_t::now();
+		if (m_deadline == clock_t::time_point{})
+		{
+			m_deadline = now;
+			return;
+		}
+
+		m_deadline += m_interval;
+		if (now >= m_deadline)
+		{
+			m_deadline = now;
+			m_missed++;
+			return;
+		}
+		wait_until(m_deadline);
+	}
+
+	void wait_until(clock_t::time_point deadline)
+	{
+		auto const wake_target = deadline - m_margin;
+		if (clock_t::now() < wake_target)
+		{
+			std::this_thread::sleep_until(wake_target);
+			record_oversleep(clock_t::now() - wake_target);
+		}
+
+		while (clock_t::now() < deadline)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// Time reserved before each deadline for the spin phase.
+	clock_t::duration margin() const noexcept { return m_margin; }
+
+	uint64_t missed_deadlines() const noexcept { return m_missed; }
+
+private:
+	constexpr static size_t num_samples = 64;
+
+	void record_oversleep(clock_t::duration d)
+	{
+		m_samples[m_next_sample++ % num_samples] = d;
+		auto const count = std::min(m_next_sample, size_t{ num_samples });
+
+		auto sorted = m_samples;
+		auto const p95 = sorted.begin() + (count * 95) / 100;
+		std::nth_element(sorted.begin(), p95, sorted.begin() + count);
+
+		// keep some headroom above the measured jitter
+		auto const target = *p95 + *p95 / 4 + std::chrono::microseconds(50);
+		m_margin = std::min<clock_t::duration>(std::max<clock_t::duration>(target, std::chrono::microseconds(100)), std::chrono::milliseconds(4));
+	}
+
+	pacing_mode m_mode = pacing_mode::fixed_rate;
+
+	clock_t::duration m_interval = std::chrono::duration_cast<clock_t::duration>(std::chrono::microseconds(16667));
+
+	clock_t::duration m_margin = std::chrono::microseconds(1500);
+
+	clock_t::time_point m_deadline;
+
+	std::array<clock_t::duration, num_samples> m_samples{};
+
+	size_t m_next_sample = 0;
+
+	uint64_t m_missed = 0;
+};
+
+}}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "sdl.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace es { namespace sdl {
+
+constexpr static auto max_actions = uint32_t{ 64 };
+
+constexpr uint64_t action_bit(uint32_t action) { return uint64_t{ 1 } << action; }
+
+// Actions as seen by one simulation tick. pressed and released keep edges
+// that happened between two polls even if the key went down and up again.
+struct action_state
+{
+	uint64_t held;
+	uint64_t pressed;
+	uint64_t released;
+
+	bool is_held(uint32_t a) const noexcept { return (held & action_bit(a)) != 0; }
+	bool was_pressed(uint32_t a) const noexcept { return (pressed & action_bit(a)) != 0; }
+	bool was_released(uint32_t a) const noexcept { return (released & action_bit(a)) != 0; }
+};
+
+// Recording layout, little-endian: input_record_header followed by one
+// input_record per poll.
+struct input_record_header
+{
+	char magic[4];
+	uint32_t version;
+};
+
+struct input_record
+{
+	uint64_t held;
+	uint64_t pressed;
+	uint64_t released;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+constexpr static char input_record_magic[4] = { 'E', 'S', 'I', 'N' };
+
+constexpr static auto input_record_version = uint32_t{ 1 };
+
+constexpr static auto input_record_quit = uint32_t{ 1 };
+
+// Turns SDL keyboard events into action bitsets through a flat scancode
+// table. Call poll() once per simulation tick on the thread that owns the
+// window; the events of a frame land in its first tick. Every polled state
+// can be recorded to a file, and a recording replays in place of the
+// keyboard, one record per poll, so a session repeats tick for tick.
+class input
+{
+public:
+	constexpr static auto no_action = uint8_t{ 0xff };
+
+	input()
+	{
+		m_bindings.fill(uint8_t{ no_action });
+		m_keys.fill(0);
+		m_held_keys.fill(0);
+	}
+
+	void bind(SDL_Scancode key, uint32_t action)
+	{
+		assert(key >= 0 && key < SDL_NUM_SCANCODES && action < max_actions);
+		m_bindings[key] = static_cast<uint8_t>(action);
+		recount();
+	}
+
+	void unbind(SDL_Scancode key)
+	{
+		assert(key >= 0 && key < SDL_NUM_SCANCODES);
+		m_bindings[key] = no_action;
+		recount();
+	}
+
+	uint8_t binding(SDL_Scancode key) const { return m_bindings[key]; }
+
+	void poll()
+	{
+		m_state.pressed = 0;
+		m_state.released = 0;
+
+		SDL_Event e;
+		while (SDL_PollEvent(&e))
+		{
+			switch (e.type)
+			{
+			case SDL_QUIT:
+				m_quit = true;
+				break;
+			case SDL_KEYDOWN:
+				if (!e.key.repeat)
+					key(e.key.keysym.scancode, true);
+				break;
+			case SDL_KEYUP:
+				key(e.key.keysym.scancode, false);
+				break;
+			}
+		}
+
+		m_state.held = 0;
+		for (uint32_t a = 0; a < max_actions; a++)
+		{
+			if (m_held_keys[a])
+				m_state.held |= action_bit(a);
+		}
+
+		if (m_replay)
+			read_record();
+		if (m_record)
+			write_record();
+
+		m_ticks++;
+	}
+
+	action_state const& state() const noexcept { return m_state; }
+
+	bool held(uint32_t a) const noexcept { return m_state.is_held(a); }
+	bool pressed(uint32_t a) const noexcept { return m_state.was_pressed(a); }
+	bool released(uint32_t a) const noexcept { return m_state.was_released(a); }
+
+	// Set by SDL_QUIT, or by a replayed quit, or once a replay runs out.
+	bool quit_requested() const noexcept { return m_quit; }
+
+	uint64_t ticks() const noexcept { return m_ticks; }
+
+	// Writes every following poll to path until stop_recording().
+	bool record(char const* path)
+	{
+		m_record.reset(std::fopen(path, "wb"));
+		if (!m_record)
+		{
+			printf("Fail | could not open '%s' for writing\n", path);
+			return false;
+		}
+
+		auto header = input_record_header{};
+		std::memcpy(header.magic, input_record_magic, sizeof(header.magic));
+		header.version = input_record_version;
+		if (std::fwrite(&header, sizeof(header), 1, m_record.get()) != 1)
+		{
+			printf("Fail | writing '%s'\n", path);
+			m_record.reset();
+			return false;
+		}
+		return true;
+	}
+
+	void stop_recording() { m_record.reset(); }
+
+	bool recording() const noexcept { return m_record != nullptr; }
+
+	// Replaces the keyboard with the recording at path. Live SDL_QUIT events
+	// still count.
+	bool replay(char const* path)
+	{
+		m_replay.reset(std::fopen(path, "rb"));
+		if (!m_replay)
+		{
+			printf("Fail | could not open '%s'\n", path);
+			return false;
+		}
+
+		auto header = input_record_header{};
+		if (std::fread(&header, sizeof(header), 1, m_replay.get()) != 1
+			|| std::memcmp(header.magic, input_record_magic, sizeof(header.magic)) != 0 || header.version != input_record_version)
+		{
+			printf("Fail | '%s' is not a version 1 input recording\n", path);
+			m_replay.reset();
+			return false;
+		}
+		return true;
+	}
+
+	bool replaying() const noexcept { return m_replay != nullptr; }
+
+private:
+	using file_t = std::unique_ptr<FILE, int(*)(FILE*)>;
+
+	void key(SDL_Scancode k, bool down)
+	{
+		if (k < 0 || k >= SDL_NUM_SCANCODES || m_keys[k] == down)
+			return;
+
+		m_keys[k] = down;
+		auto const a = m_bindings[k];
+		if (a == no_action)
+			return;
+
+		if (down)
+		{
+			m_held_keys[a]++;
+			m_state.pressed |= action_bit(a);
+		}
+		else
+		{
+			m_held_keys[a]--;
+			m_state.released |= action_bit(a);
+		}
+	}
+
+	// Rebuilds the per-action key counts after the bindings changed.
+	void recount()
+	{
+		m_held_keys.fill(0);
+		for (size_t k = 0; k < m_keys.size(); k++)
+		{
+			if (m_keys[k] && m_bindings[k] != no_action)
+				m_held_keys[m_bindings[k]]++;
+		}
+	}
+
+	void read_record()
+	{
+		auto r = input_record{};
+		if (std::fread(&r, sizeof(r), 1, m_replay.get()) != 1)
+		{
+			m_replay.reset();
+			m_state = action_state{ 0, 0, 0 };
+			m_quit = true;
+			return;
+		}
+
+		m_state = action_state{ r.held, r.pressed, r.released };
+		if (r.flags & input_record_quit)
+			m_quit = true;
+	}
+
+	void write_record()
+	{
+		auto const r = input_record{ m_state.held, m_state.pressed, m_state.released, m_quit ? input_record_quit : 0u, 0u };
+		if (std::fwrite(&r, sizeof(r), 1, m_record.get()) != 1)
+		{
+			printf("Fail | writing input recording\n");
+			m_record.reset();
+		}
+	}
+
+	std::array<uint8_t, SDL_NUM_SCANCODES> m_bindings;
+
+	std::array<uint8_t, SDL_NUM_SCANCODES> m_keys;
+
+	// keys currently down per action
+	std::array<uint8_t, max_actions> m_held_keys;
+
+	action_state m_state{ 0, 0, 0 };
+
+	bool m_quit = false;
+
+	uint64_t m_ticks = 0;
+
+	file_t m_record{ nullptr, &std::fclose };
+
+	file_t m_replay{ nullptr, &std::fclose };
+};
+
+}}
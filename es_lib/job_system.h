@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace es { namespace sdl {
+
+class job_system;
+
+// Counts unfinished jobs. Wait on it with job_system::wait(), or chain work
+// after it with job_system::run_after(). A counter must outlive the jobs
+// that reference it.
+class job_counter
+{
+public:
+	job_counter() = default;
+
+	job_counter(job_counter const&) = delete;
+	job_counter& operator=(job_counter const&) = delete;
+
+	bool done() const noexcept { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class job_system;
+
+	std::atomic<int> m_pending{ 0 };
+
+	// Guards the final decrement and the continuations, so a waiter that saw
+	// the counter reach zero can safely destroy it.
+	std::mutex m_mutex;
+
+	// Jobs released once the counter drops to zero.
+	std::vector<std::function<void()>> m_continuations;
+};
+
+// Runs jobs on one worker thread per remaining core. Each thread owns a
+// deque: it pushes and pops its own work at the back and, when empty,
+// steals from the front of the others. Threads that wait on a counter run
+// jobs meanwhile instead of blocking, so waiting inside a job is allowed.
+// Threads that are not workers (e.g. the main thread owning the SDL
+// renderer) share one extra deque.
+class job_system
+{
+public:
+	explicit job_system(unsigned num_workers = default_num_workers())
+		: m_queues(num_workers + 1)
+	{
+		for (auto& q : m_queues)
+		{
+			q.reset(new queue);
+		}
+		for (unsigned i = 0; i < num_workers; i++)
+		{
+			m_workers.emplace_back([this, i] { work(i); });
+		}
+	}
+
+	job_system(job_system const&) = delete;
+	job_system& operator=(job_system const&) = delete;
+
+	~job_system()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_sleep_mutex };
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (auto& t : m_workers)
+		{
+			t.join();
+		}
+	}
+
+	// Worker threads plus the calling thread.
+	unsigned concurrency() const noexcept { return static_cast<unsigned>(m_workers.size() + 1); }
+
+	void run(std::function<void()> fn, job_counter* counter = nullptr)
+	{
+		if (counter)
+			counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+		push(job{ std::move(fn), counter });
+	}
+
+	// Runs fn once dependency has no pending jobs.
+	void run_after(job_counter& dependency, std::function<void()> fn, job_counter* counter = nullptr)
+	{
+		if (counter)
+			counter->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+		auto j = std::make_shared<job>(job{ std::move(fn), counter });
+		{
+			std::lock_guard<std::mutex> lock{ dependency.m_mutex };
+			if (!dependency.done())
+			{
+				dependency.m_continuations.push_back([this, j] { push(std::move(*j)); });
+				return;
+			}
+		}
+		push(std::move(*j));
+	}
+
+	// Runs other jobs until the counter reaches zero.
+	void wait(job_counter& counter)
+	{
+		auto const self = queue_index();
+		while (!counter.done())
+		{
+			job j;
+			if (try_take(self, j))
+			{
+				execute(j);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		// let the thread that finished the last job release the counter
+		std::lock_guard<std::mutex> lock{ counter.m_mutex };
+	}
+
+	// Calls fn(first, last) over [begin, end) in chunks of about grain
+	// elements spread over all threads, and returns when all are done.
+	template <typename Fn>
+	void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn)
+	{
+		if (begin >= end)
+			return;
+
+		grain = std::max<size_t>(grain, 1);
+		if (end - begin <= grain || m_workers.empty())
+		{
+			fn(begin, end);
+			return;
+		}
+
+		job_counter counter;
+		for (auto first = begin + grain; first < end; first += grain)
+		{
+			auto const last = std::min(first + grain, end);
+			run([&fn, first, last] { fn(first, last); }, &counter);
+		}
+		fn(begin, begin + grain);
+		wait(counter);
+	}
+
+private:
+	struct job
+	{
+		std::function<void()> fn;
+		job_counter* counter;
+	};
+
+	struct queue
+	{
+		std::mutex mutex;
+		std::deque<job> jobs;
+	};
+
+	static unsigned default_num_workers()
+	{
+		auto const n = std::thread::hardware_concurrency();
+		return n > 1 ? n - 1 : 1;
+	}
+
+	struct thread_state
+	{
+		job_system const* owner;
+		size_t index;
+	};
+
+	static thread_state& current_thread()
+	{
+		static thread_local thread_state state{ nullptr, 0 };
+		return state;
+	}
+
+	size_t queue_index() const
+	{
+		auto const& t = current_thread();
+		return t.owner == this ? t.index : m_queues.size() - 1;
+	}
+
+	void push(job j)
+	{
+		auto& q = *m_queues[queue_index()];
+		{
+			std::lock_guard<std::mutex> lock{ q.mutex };
+			q.jobs.push_back(std::move(j));
+		}
+		m_queued.fetch_add(1);
+
+		// a worker that counted itself as sleeping may be between checking
+		// m_queued and waiting; taking the mutex makes sure it is waiting
+		if (m_sleeping.load() > 0)
+		{
+			{ std::lock_guard<std::mutex> lock{ m_sleep_mutex }; }
+			m_wake.notify_one();
+		}
+	}
+
+	bool try_take(size_t self, job& out)
+	{
+		{
+			auto& q = *m_queues[self];
+			std::lock_guard<std::mutex> lock{ q.mutex };
+			if (!q.jobs.empty())
+			{
+				out = std::move(q.jobs.back());
+				q.jobs.pop_back();
+				taken();
+				return true;
+			}
+		}
+
+		for (size_t n = 1; n < m_queues.size(); n++)
+		{
+			auto& q = *m_queues[(self + n) % m_queues.size()];
+			std::lock_guard<std::mutex> lock{ q.mutex };
+			if (!q.jobs.empty())
+			{
+				out = std::move(q.jobs.front());
+				q.jobs.pop_front();
+				taken();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void taken()
+	{
+		m_queued.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void execute(job& j)
+	{
+		j.fn();
+
+		auto const c = j.counter;
+		if (!c)
+			return;
+
+		std::vector<std::function<void()>> continuations;
+		{
+			std::lock_guard<std::mutex> lock{ c->m_mutex };
+			if (c->m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+
+			continuations.swap(c->m_continuations);
+		}
+		for (auto& fn : continuations)
+		{
+			fn();
+		}
+	}
+
+	void work(size_t index)
+	{
+		current_thread() = thread_state{ this, index };
+
+		for (;;)
+		{
+			job j;
+			if (try_take(index, j))
+			{
+				execute(j);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock{ m_sleep_mutex };
+			m_sleeping.fetch_add(1);
+			m_wake.wait(lock, [this] { return m_stopping || m_queued.load() > 0; });
+			m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+			if (m_stopping)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<queue>> m_queues;
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_sleep_mutex;
+
+	std::condition_variable m_wake;
+
+	// jobs sitting in any queue; only sleeping workers need the mutex
+	std::atomic<size_t> m_queued{ 0 };
+
+	std::atomic<size_t> m_sleeping{ 0 };
+
+	bool m_stopping = false;
+};
+
+}}
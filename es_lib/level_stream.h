@@ -0,0 +1,458 @@
+#pragma once
+
+#include "sdl.h"
+#include "tile_map.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Level file layout, little-endian:
+//
+//	level_header
+//	level_chunk_entry[chunks_x * chunks_y], row-major
+//	chunk data
+//
+// A chunk is stored as a uint32 run count followed by level_runs covering
+// its chunk_area tiles in row-major order. Chunks without any tiles have
+// size 0 and no data.
+struct level_header
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width;
+	int32_t height;
+	uint32_t chunk_size;
+	uint32_t reserved;
+};
+
+struct level_chunk_entry
+{
+	uint64_t offset;
+	uint32_t size;
+	uint32_t reserved;
+};
+
+struct level_run
+{
+	uint32_t count;
+	uint32_t visual;
+	uint32_t physical;
+};
+
+constexpr static char level_magic[4] = { 'E', 'S', 'L', 'V' };
+
+constexpr static auto level_version = uint32_t{ 1 };
+
+inline bool write_level(char const* path, tile_map const& map)
+{
+	auto header = level_header{};
+	std::memcpy(header.magic, level_magic, sizeof(header.magic));
+	header.version = level_version;
+	header.width = map.width();
+	header.height = map.height();
+	header.chunk_size = chunk_size;
+
+	auto const num_chunks = static_cast<size_t>(map.chunks_x()) * map.chunks_y();
+	std::vector<level_chunk_entry> entries(num_chunks);
+	std::vector<uint32_t> data;
+	auto offset = static_cast<uint64_t>(sizeof(header) + sizeof(level_chunk_entry) * num_chunks);
+
+	for (int cy = 0; cy < map.chunks_y(); cy++)
+	{
+		for (int cx = 0; cx < map.chunks_x(); cx++)
+		{
+			auto const c = map.chunk_at(cx, cy);
+			auto const empty = !c || (!c->num_visible && std::all_of(c->physical.begin(), c->physical.end(), [](uint32_t p) { return p == 0; }));
+			if (empty)
+				continue;
+
+			auto const first = data.size();
+			data.push_back(0);
+			for (int i = 0; i < chunk_area;)
+			{
+				auto run = level_run{ 1, c->visual[i], c->physical[i] };
+				while (i + static_cast<int>(run.count) < chunk_area && c->visual[i + run.count] == run.visual && c->physical[i + run.count] == run.physical)
+					run.count++;
+
+				data.insert(data.end(), { run.count, run.visual, run.physical });
+				data[first]++;
+				i += run.count;
+			}
+
+			auto const size = static_cast<uint32_t>((data.size() - first) * sizeof(uint32_t));
+			entries[static_cast<size_t>(cy) * map.chunks_x() + cx] = level_chunk_entry{ offset, size, 0 };
+			offset += size;
+		}
+	}
+
+	auto const file = std::unique_ptr<FILE, int(*)(FILE*)>{ std::fopen(path, "wb"), &std::fclose };
+	if (!file)
+	{
+		printf("Fail | could not open '%s' for writing\n", path);
+		return false;
+	}
+
+	auto ok = std::fwrite(&header, sizeof(header), 1, file.get()) == 1
+		&& std::fwrite(entries.data(), sizeof(level_chunk_entry), entries.size(), file.get()) == entries.size();
+	if (!data.empty())
+		ok = ok && std::fwrite(data.data(), sizeof(uint32_t), data.size(), file.get()) == data.size();
+
+	if (!ok)
+		printf("Fail | writing '%s'\n", path);
+	return ok;
+}
+
+// Random access to the chunks of a level file. Not thread safe; the
+// streamer only reads from its loader thread.
+class level_file
+{
+public:
+	bool open(char const* path)
+	{
+		m_file.reset(std::fopen(path, "rb"));
+		if (!m_file)
+		{
+			printf("Fail | could not open '%s'\n", path);
+			return false;
+		}
+
+		if (std::fread(&m_header, sizeof(m_header), 1, m_file.get()) != 1
+			|| std::memcmp(m_header.magic, level_magic, sizeof(m_header.magic)) != 0 || m_header.version != level_version
+			|| m_header.chunk_size != chunk_size || m_header.width <= 0 || m_header.height <= 0)
+			return fail(path, "not a version 1 level");
+
+		m_entries.resize(static_cast<size_t>(chunks_x()) * chunks_y());
+		if (std::fread(m_entries.data(), sizeof(level_chunk_entry), m_entries.size(), m_file.get()) != m_entries.size())
+			return fail(path, "truncated index");
+
+		return true;
+	}
+
+	bool is_open() const noexcept { return m_file != nullptr; }
+
+	int width() const noexcept { return m_header.width; }
+
+	int height() const noexcept { return m_header.height; }
+
+	int chunks_x() const noexcept { return (m_header.width + chunk_size - 1) / chunk_size; }
+
+	int chunks_y() const noexcept { return (m_header.height + chunk_size - 1) / chunk_size; }
+
+	// nullptr for empty chunks and on errors.
+	std::unique_ptr<tile_chunk> load_chunk(int cx, int cy)
+	{
+		auto const& e = m_entries[static_cast<size_t>(cy) * chunks_x() + cx];
+		if (!e.size)
+			return nullptr;
+
+		m_buffer.resize(e.size / sizeof(uint32_t));
+		if (std::fseek(m_file.get(), static_cast<long>(e.offset), SEEK_SET) != 0
+			|| std::fread(m_buffer.data(), 1, e.size, m_file.get()) != e.size)
+		{
+			printf("Fail | reading level chunk %d,%d\n", cx, cy);
+			return nullptr;
+		}
+
+		std::unique_ptr<tile_chunk> c{ new tile_chunk{} };
+		auto const num_runs = m_buffer.empty() ? 0 : m_buffer[0];
+		size_t tile = 0;
+		for (size_t r = 0; r < num_runs && 1 + 3 * r + 2 < m_buffer.size(); r++)
+		{
+			auto const run = &m_buffer[1 + 3 * r];
+			if (tile + run[0] > static_cast<size_t>(chunk_area))
+				break;
+
+			std::fill_n(c->visual.begin() + tile, run[0], run[1]);
+			std::fill_n(c->physical.begin() + tile, run[0], run[2]);
+			if (run[1])
+				c->num_visible += run[0];
+			tile += run[0];
+		}
+
+		if (tile != static_cast<size_t>(chunk_area))
+		{
+			printf("Fail | corrupt level chunk %d,%d\n", cx, cy);
+			return nullptr;
+		}
+		return c;
+	}
+
+private:
+	using file_t = std::unique_ptr<FILE, int(*)(FILE*)>;
+
+	bool fail(char const* path, char const* reason)
+	{
+		printf("Fail | level '%s': %s\n", path, reason);
+		m_file.reset();
+		return false;
+	}
+
+	file_t m_file{ nullptr, &std::fclose };
+
+	level_header m_header{};
+
+	std::vector<level_chunk_entry> m_entries;
+
+	std::vector<uint32_t> m_buffer;
+};
+
+// Keeps the chunks of a level file around the camera resident in a
+// tile_map. Chunks are read on a background thread, nearest first, and
+// installed by update(), which never waits for I/O. Resident chunks that
+// are no longer wanted are evicted least recently used first whenever the
+// budget is exceeded; chunks in view are never evicted, so a budget smaller
+// than the view is exceeded rather than thrashed.
+class level_streamer
+{
+public:
+	explicit level_streamer(size_t budget_bytes = 16 << 20, int margin_chunks = 1)
+		: m_budget{ budget_bytes }
+		, m_margin{ margin_chunks }
+	{
+	}
+
+	level_streamer(level_streamer const&) = delete;
+	level_streamer& operator=(level_streamer const&) = delete;
+
+	~level_streamer() { stop(); }
+
+	bool open(char const* path)
+	{
+		stop();
+		if (!m_file.open(path))
+			return false;
+
+		m_map.reset(new tile_map{ m_file.width(), m_file.height() });
+		auto const n = static_cast<size_t>(m_file.chunks_x()) * m_file.chunks_y();
+		m_state.assign(n, chunk_state::unloaded);
+		m_lru.clear();
+		m_lru_pos.assign(n, m_lru.end());
+		m_resident_bytes = 0;
+
+		m_stopping = false;
+		m_thread = std::thread{ [this] { work(); } };
+		return true;
+	}
+
+	// Only valid after open(). Chunks change only inside update().
+	tile_map const& map() const { return *m_map; }
+
+	// Call once per frame, while nobody reads the map, with the same camera
+	// as scoped_render::set_camera.
+	void update(vecf camera, veci view)
+	{
+		install_loaded();
+
+		auto const area = visible_tiles(camera, view);
+		auto const cx0 = std::max(area.x / chunk_size - m_margin, 0);
+		auto const cy0 = std::max(area.y / chunk_size - m_margin, 0);
+		auto const cx1 = std::min((area.x + area.w - 1) / chunk_size + m_margin, m_file.chunks_x() - 1);
+		auto const cy1 = std::min((area.y + area.h - 1) / chunk_size + m_margin, m_file.chunks_y() - 1);
+		auto const centre_x = (area.x + area.w / 2) / chunk_size;
+		auto const centre_y = (area.y + area.h / 2) / chunk_size;
+
+		std::vector<uint32_t> wanted;
+		size_t num_wanted = 0;
+		for (int cy = cy0; cy <= cy1; cy++)
+		{
+			for (int cx = cx0; cx <= cx1; cx++)
+			{
+				auto const i = index(cx, cy);
+				num_wanted++;
+				if (m_state[i] == chunk_state::resident)
+					touch(i);
+				else
+					wanted.push_back(i);
+			}
+		}
+
+		std::sort(wanted.begin(), wanted.end(), [&](uint32_t a, uint32_t b)
+		{
+			return distance(a, centre_x, centre_y) < distance(b, centre_x, centre_y);
+		});
+
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+
+			// Requests still waiting are replaced, which drops the ones the
+			// camera moved away from. Chunks the loader already took stay
+			// requested until they arrive.
+			for (auto const i : m_requests)
+			{
+				m_state[i] = chunk_state::unloaded;
+			}
+			m_requests.clear();
+			for (auto const i : wanted)
+			{
+				if (m_state[i] == chunk_state::unloaded)
+				{
+					m_state[i] = chunk_state::requested;
+					m_requests.push_back(i);
+				}
+			}
+		}
+		if (!wanted.empty())
+			m_work_available.notify_one();
+
+		evict(num_wanted);
+	}
+
+	size_t resident_bytes() const noexcept { return m_resident_bytes; }
+
+	size_t budget() const noexcept { return m_budget; }
+
+	void set_budget(size_t bytes) noexcept { m_budget = bytes; }
+
+	size_t chunks_loaded() const noexcept { return m_chunks_loaded; }
+
+	size_t chunks_evicted() const noexcept { return m_chunks_evicted; }
+
+private:
+	enum class chunk_state : uint8_t
+	{
+		unloaded,
+		requested,	// queued or being read
+		resident,	// installed, possibly as an empty chunk
+	};
+
+	struct loaded_chunk
+	{
+		uint32_t index;
+		std::unique_ptr<tile_chunk> chunk;
+	};
+
+	uint32_t index(int cx, int cy) const { return static_cast<uint32_t>(cy * m_file.chunks_x() + cx); }
+
+	int distance(uint32_t i, int x, int y) const
+	{
+		return std::abs(static_cast<int>(i % m_file.chunks_x()) - x) + std::abs(static_cast<int>(i / m_file.chunks_x()) - y);
+	}
+
+	void touch(uint32_t i)
+	{
+		if (m_lru_pos[i] != m_lru.end())
+			m_lru.erase(m_lru_pos[i]);
+		m_lru_pos[i] = m_lru.insert(m_lru.end(), i);
+	}
+
+	void install_loaded()
+	{
+		std::vector<loaded_chunk> loaded;
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			loaded.swap(m_loaded);
+		}
+
+		for (auto& l : loaded)
+		{
+			auto const cx = static_cast<int>(l.index % m_file.chunks_x());
+			auto const cy = static_cast<int>(l.index / m_file.chunks_x());
+			if (l.chunk)
+				m_resident_bytes += sizeof(tile_chunk);
+			m_map->install_chunk(cx, cy, std::move(l.chunk));
+			m_state[l.index] = chunk_state::resident;
+			m_chunks_loaded++;
+			touch(l.index);
+		}
+	}
+
+	// The most recently touched num_protected chunks are the ones in view.
+	void evict(size_t num_protected)
+	{
+		while (m_resident_bytes > m_budget && m_lru.size() > num_protected)
+		{
+			auto const i = m_lru.front();
+			m_lru.pop_front();
+			m_lru_pos[i] = m_lru.end();
+
+			if (m_map->release_chunk(static_cast<int>(i % m_file.chunks_x()), static_cast<int>(i / m_file.chunks_x())))
+				m_resident_bytes -= sizeof(tile_chunk);
+			m_state[i] = chunk_state::unloaded;
+			m_chunks_evicted++;
+		}
+	}
+
+	void work()
+	{
+		for (;;)
+		{
+			uint32_t i;
+			{
+				std::unique_lock<std::mutex> lock{ m_mutex };
+				m_work_available.wait(lock, [this] { return m_stopping || !m_requests.empty(); });
+				if (m_stopping)
+					return;
+
+				i = m_requests.front();
+				m_requests.pop_front();
+			}
+
+			auto chunk = m_file.load_chunk(static_cast<int>(i % m_file.chunks_x()), static_cast<int>(i / m_file.chunks_x()));
+
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_loaded.push_back(loaded_chunk{ i, std::move(chunk) });
+		}
+	}
+
+	void stop()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_stopping = true;
+		}
+		m_work_available.notify_all();
+		m_thread.join();
+		m_requests.clear();
+		m_loaded.clear();
+	}
+
+	level_file m_file;
+
+	std::unique_ptr<tile_map> m_map;
+
+	size_t m_budget;
+
+	int m_margin;
+
+	// render thread only
+	std::vector<chunk_state> m_state;
+
+	// resident chunks, least recently used first
+	std::list<uint32_t> m_lru;
+
+	std::vector<std::list<uint32_t>::iterator> m_lru_pos;
+
+	size_t m_resident_bytes = 0;
+
+	size_t m_chunks_loaded = 0;
+
+	size_t m_chunks_evicted = 0;
+
+	std::mutex m_mutex;
+
+	std::condition_variable m_work_available;
+
+	std::deque<uint32_t> m_requests;
+
+	std::vector<loaded_chunk> m_loaded;
+
+	bool m_stopping = false;
+
+	std::thread m_thread;
+};
+
+}}
@@ -0,0 +1,631 @@
+#pragma once
+
+#include "sdl.h"
+#include "atlas.h"
+#include "canvas.h"
+#include "entity_store.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Marsaglia's xorshift32. The whole state is one word, so it can be saved
+// and restored with state() and set_state().
+class xorshift_rng
+{
+public:
+	constexpr static auto default_seed = uint32_t{ 2463534242u };
+
+	explicit xorshift_rng(uint32_t seed = default_seed) { set_state(seed); }
+
+	uint32_t next() noexcept
+	{
+		auto x = m_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return m_state = x;
+	}
+
+	// uniform in [0, 1)
+	float unit() noexcept { return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f); }
+
+	float range(float lo, float hi) noexcept { return lo + (hi - lo) * unit(); }
+
+	uint32_t state() const noexcept { return m_state; }
+
+	// xorshift never leaves zero, so it is replaced by the default seed
+	void set_state(uint32_t s) noexcept { m_state = s ? s : uint32_t{ default_seed }; }
+
+private:
+	uint32_t m_state;
+};
+
+// How an emitter spawns particles and how they look over their lifetime.
+// Size and color are interpolated from start to end as a particle ages.
+struct emitter_config
+{
+	int32_t visual = 0;
+	float rate = 0.0f;				// particles per second, 0 for bursts only
+	float lifetime_min = 1.0f;		// seconds
+	float lifetime_max = 1.0f;
+	float speed_min = 0.0f;			// blocks per second
+	float speed_max = 0.0f;
+	float angle_min = 0.0f;			// degrees, 0 along +x and 90 along +y
+	float angle_max = 360.0f;
+	float spread = 0.0f;			// particles start up to this many blocks from the emitter
+	vecf gravity{ 0.0f, 0.0f };		// blocks per second squared
+	float size_start = 0.25f;		// blocks
+	float size_end = 0.25f;
+	SDL_Color color_start{ 255, 255, 255, 255 };
+	SDL_Color color_end{ 255, 255, 255, 0 };
+};
+
+// Reads emitter settings from `key = values` lines. Ranges take a minimum
+// and a maximum, or one value for both; colors are r g b a from 0 to 255.
+// Blank lines and lines starting with # are skipped, and keys left out keep
+// their current value.
+//
+//	visual = 3
+//	rate = 2000
+//	lifetime = 0.4 0.9
+//	speed = 2 5
+//	angle = 240 300
+//	gravity = 0 9.8
+//	size = 0.3 0.05
+//	color_start = 255 200 80 255
+//	color_end = 255 40 0 0
+inline bool parse_emitter(char const* text, emitter_config& out)
+{
+	auto const is_space = [](char ch) { return ch == ' ' || ch == '\t' || ch == '\r'; };
+
+	auto line_number = 0;
+	for (auto line = text; *line; )
+	{
+		auto const line_end = line + std::strcspn(line, "\n");
+		auto const next = *line_end ? line_end + 1 : line_end;
+		line_number++;
+
+		auto key = line;
+		while (key < line_end && is_space(*key)) key++;
+		if (key == line_end || *key == '#')
+		{
+			line = next;
+			continue;
+		}
+
+		auto const eq = std::find(key, line_end, '=');
+		auto key_end = eq;
+		while (key_end > key && is_space(key_end[-1])) key_end--;
+
+		// at most four numbers, all of them up to the end of the line
+		float v[4];
+		size_t n = 0;
+		auto value = std::string{ eq == line_end ? line_end : eq + 1, line_end };
+		auto p = value.c_str();
+		for (;;)
+		{
+			while (is_space(*p)) p++;
+			if (!*p || n == 4)
+				break;
+
+			char* end;
+			v[n] = std::strtof(p, &end);
+			if (end == p)
+				break;
+			n++;
+			p = end;
+		}
+
+		auto const key_is = [&](char const* k)
+		{
+			return static_cast<size_t>(key_end - key) == std::strlen(k) && std::strncmp(key, k, key_end - key) == 0;
+		};
+		auto const to_color = [&]()
+		{
+			auto const channel = [](float f) { return static_cast<Uint8>(std::min(std::max(f, 0.0f), 255.0f)); };
+			return SDL_Color{ channel(v[0]), channel(v[1]), channel(v[2]), channel(v[3]) };
+		};
+
+		auto ok = eq != line_end && !*p;
+		if (ok)
+		{
+			if (key_is("visual") && n == 1) out.visual = static_cast<int32_t>(v[0]);
+			else if (key_is("rate") && n == 1) out.rate = v[0];
+			else if (key_is("lifetime") && (n == 1 || n == 2)) { out.lifetime_min = v[0]; out.lifetime_max = v[n - 1]; }
+			else if (key_is("speed") && (n == 1 || n == 2)) { out.speed_min = v[0]; out.speed_max = v[n - 1]; }
+			else if (key_is("angle") && (n == 1 || n == 2)) { out.angle_min = v[0]; out.angle_max = v[n - 1]; }
+			else if (key_is("spread") && n == 1) out.spread = v[0];
+			else if (key_is("gravity") && n == 2) out.gravity = vecf{ v[0], v[1] };
+			else if (key_is("size") && (n == 1 || n == 2)) { out.size_start = v[0]; out.size_end = v[n - 1]; }
+			else if (key_is("color_start") && n == 4) out.color_start = to_color();
+			else if (key_is("color_end") && n == 4) out.color_end = to_color();
+			else ok = false;
+		}
+
+		if (!ok)
+		{
+			printf("Fail | emitter line %d: '%.*s'\n", line_number, static_cast<int>(line_end - line), line);
+			return false;
+		}
+		line = next;
+	}
+
+	if (out.lifetime_min <= 0.0f || out.lifetime_max < out.lifetime_min || out.rate < 0.0f)
+	{
+		printf("Fail | emitter needs 0 < lifetime min <= max and a rate >= 0\n");
+		return false;
+	}
+	return true;
+}
+
+inline bool load_emitter(char const* path, emitter_config& out)
+{
+	auto const file = std::unique_ptr<FILE, int(*)(FILE*)>{ std::fopen(path, "rb"), &std::fclose };
+	if (!file)
+	{
+		printf("Fail | could not open '%s'\n", path);
+		return false;
+	}
+
+	std::string text;
+	char buffer[1024];
+	size_t n;
+	while ((n = std::fread(buffer, 1, sizeof(buffer), file.get())) > 0)
+	{
+		text.append(buffer, n);
+	}
+	return parse_emitter(text.c_str(), out);
+}
+
+// Fixed-capacity pool of short-lived particles in structure-of-arrays form.
+// All storage is allocated up front; spawns beyond the capacity are dropped
+// and counted. Live particles are packed at the front of the arrays so
+// update() runs straight loops over floats, and a dead particle is replaced
+// by the last live one.
+class particle_system
+{
+public:
+	explicit particle_system(size_t capacity = 65536, uint32_t seed = 1)
+		: m_capacity{ capacity }
+		, m_rng{ seed }
+	{
+		for_each_array([capacity](auto& a) { a.resize(capacity); });
+		m_order.resize(capacity);
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		m_vertices.resize(capacity * 4);
+		m_indices.resize(capacity * 6);
+		for (size_t q = 0; q < capacity; q++)
+		{
+			int const quad[] = { 0, 1, 2, 0, 2, 3 };
+			for (size_t k = 0; k < 6; k++)
+				m_indices[q * 6 + k] = static_cast<int>(q * 4) + quad[k];
+		}
+#endif
+	}
+
+	// Returns the index of the new emitter. Emitters are never removed; stop
+	// one with set_active() instead.
+	uint32_t add_emitter(emitter_config const& config, vecf position)
+	{
+		m_emitters.push_back(emitter{ config, position, 0.0f, true, false });
+		return static_cast<uint32_t>(m_emitters.size() - 1);
+	}
+
+	emitter_config& config(uint32_t e) { return m_emitters[e].config; }
+
+	void set_position(uint32_t e, vecf p) { m_emitters[e].position = p; }
+
+	// Inactive emitters stop spawning; their particles live out their time.
+	void set_active(uint32_t e, bool active) { m_emitters[e].active = active; }
+
+	size_t num_emitters() const noexcept { return m_emitters.size(); }
+
+	// Spawns n particles at once regardless of the emitter's rate.
+	void burst(uint32_t e, uint32_t n)
+	{
+		assert(e < m_emitters.size());
+		auto const& em = m_emitters[e];
+		auto const& cfg = em.config;
+		auto const deg = 3.14159265f / 180.0f;
+
+		auto const available = static_cast<uint32_t>(m_capacity - m_size);
+		if (n > available)
+		{
+			m_dropped += n - available;
+			n = available;
+		}
+
+		for (uint32_t k = 0; k < n; k++)
+		{
+			auto const i = m_size++;
+			auto const angle = m_rng.range(cfg.angle_min, cfg.angle_max) * deg;
+			auto const speed = m_rng.range(cfg.speed_min, cfg.speed_max);
+			auto const offset_angle = m_rng.range(0.0f, 360.0f) * deg;
+			auto const offset = cfg.spread * std::sqrt(m_rng.unit());
+
+			m_position_x[i] = em.position.x + offset * std::cos(offset_angle);
+			m_position_y[i] = em.position.y + offset * std::sin(offset_angle);
+			m_velocity_x[i] = speed * std::cos(angle);
+			m_velocity_y[i] = speed * std::sin(angle);
+			m_acceleration_x[i] = cfg.gravity.x;
+			m_acceleration_y[i] = cfg.gravity.y;
+			m_age[i] = 0.0f;
+			m_age_rate[i] = 1.0f / m_rng.range(cfg.lifetime_min, cfg.lifetime_max);
+			m_emitter[i] = e;
+		}
+	}
+
+	// Ages and moves the live particles by dt seconds, removes the expired
+	// ones and spawns what the active emitters owe for dt.
+	void update(float dt)
+	{
+		detail::integrate_axis(m_position_x.data(), m_velocity_x.data(), m_acceleration_x.data(), m_size, dt);
+		detail::integrate_axis(m_position_y.data(), m_velocity_y.data(), m_acceleration_y.data(), m_size, dt);
+
+		// age runs from 0 to 1 over the particle's lifetime
+		auto const age = m_age.data();
+		auto const age_rate = m_age_rate.data();
+		for (size_t i = 0; i < m_size; i++)
+		{
+			age[i] += age_rate[i] * dt;
+		}
+
+		// the particle moved in from the back has already been checked
+		for (auto i = m_size; i-- > 0; )
+		{
+			if (age[i] >= 1.0f)
+			{
+				auto const last = --m_size;
+				if (i != last)
+					for_each_array([i, last](auto& a) { a[i] = a[last]; });
+			}
+		}
+
+		for (uint32_t e = 0; e < m_emitters.size(); e++)
+		{
+			auto& em = m_emitters[e];
+			if (!em.active || em.config.rate <= 0.0f)
+				continue;
+
+			em.carry += em.config.rate * dt;
+			auto const n = static_cast<uint32_t>(em.carry);
+			em.carry -= static_cast<float>(n);
+			burst(e, n);
+		}
+	}
+
+	// Draws the live particles with one geometry call per texture. Visuals in
+	// the atlas draw from its pages. Positions are in blocks like sprites;
+	// unit is the size of a block in pixels. Without SDL_RenderGeometry
+	// (SDL < 2.0.18) see composite() instead.
+	void draw(context& c, texture_atlas* atlas, vecf camera, vecf unit)
+	{
+		if (!m_size)
+			return;
+
+		// where each emitter's visual comes from
+		m_sources.resize(m_emitters.size());
+		for (size_t e = 0; e < m_emitters.size(); e++)
+		{
+			auto& s = m_sources[e];
+			auto const visual = static_cast<uint32_t>(m_emitters[e].config.visual);
+			s = source{ nullptr, nullptr, SDL_Rect{ 0, 0, 0, 0 }, 0.0f, 0.0f };
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+			if (atlas && atlas->contains(visual))
+			{
+				auto const& entry = atlas->at(visual);
+				s.texture = &atlas->page(entry.page);
+				s.rect = entry.rect;
+			}
+			else if (c.has_texture(visual))
+			{
+				s.texture = &c.texture_at(visual);
+				SDL_QueryTexture(s.texture, nullptr, nullptr, &s.rect.w, &s.rect.h);
+			}
+			else
+			{
+				continue;
+			}
+
+			int w, h;
+			SDL_QueryTexture(s.texture, nullptr, nullptr, &w, &h);
+			s.texture_w = static_cast<float>(w);
+			s.texture_h = static_cast<float>(h);
+#else
+			(void)atlas;
+			auto const surface = get_visual_as_surface(c, static_cast<int32_t>(visual));
+			if (surface && surface->format->format == SDL_PIXELFORMAT_RGBA32)
+			{
+				s.surface = surface;
+				s.rect = SDL_Rect{ 0, 0, surface->w, surface->h };
+			}
+			else if (!m_emitters[e].reported)
+			{
+				printf("Fail | particles need an RGBA32 surface for visual %u without SDL_RenderGeometry\n", visual);
+				m_emitters[e].reported = true;
+			}
+#endif
+		}
+
+		// counting sort of the particles by emitter
+		m_first.assign(m_emitters.size() + 1, 0);
+		for (size_t i = 0; i < m_size; i++)
+		{
+			m_first[m_emitter[i] + 1]++;
+		}
+		for (size_t e = 0; e < m_emitters.size(); e++)
+		{
+			m_first[e + 1] += m_first[e];
+		}
+		m_slot = m_first;
+		for (size_t i = 0; i < m_size; i++)
+		{
+			m_order[m_slot[m_emitter[i]]++] = static_cast<uint32_t>(i);
+		}
+
+		m_emitter_order.resize(m_emitters.size());
+		for (uint32_t e = 0; e < m_emitters.size(); e++)
+		{
+			m_emitter_order[e] = e;
+		}
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+		composite(c, camera, unit);
+#else
+		// emitters sharing a texture are drawn together
+		std::sort(m_emitter_order.begin(), m_emitter_order.end(), [this](uint32_t a, uint32_t b)
+		{
+			return std::less<SDL_Texture*>{}(m_sources[a].texture, m_sources[b].texture);
+		});
+
+		auto first = size_t{ 0 };
+		while (first < m_emitter_order.size())
+		{
+			auto const texture = m_sources[m_emitter_order[first]].texture;
+			auto last = first + 1;
+			while (last < m_emitter_order.size() && m_sources[m_emitter_order[last]].texture == texture)
+				last++;
+
+			if (texture)
+				draw_run(c, *texture, first, last, camera, unit);
+			first = last;
+		}
+#endif
+	}
+
+	size_t size() const noexcept { return m_size; }
+
+	size_t capacity() const noexcept { return m_capacity; }
+
+	// Particles not spawned because the pool was full.
+	uint64_t dropped() const noexcept { return m_dropped; }
+
+	// Removes all particles; emitters keep their settings.
+	void clear() noexcept
+	{
+		m_size = 0;
+		for (auto& em : m_emitters)
+			em.carry = 0.0f;
+	}
+
+	xorshift_rng& rng() noexcept { return m_rng; }
+
+	// Writes the live particles, the generator and where each emitter is.
+	// Emitter settings are not saved; the loading system must have the same
+	// emitters, added in the same order.
+	void save(snapshot_writer& w) const
+	{
+		w.write(static_cast<uint64_t>(m_size));
+		w.write(m_rng.state());
+		w.write(static_cast<uint32_t>(m_emitters.size()));
+		for (auto const& em : m_emitters)
+		{
+			w.write(em.position);
+			w.write(em.carry);
+			w.write(uint32_t{ em.active });
+		}
+		for_each_array([this, &w](auto const& a) { w.write(a.data(), m_size); });
+	}
+
+	bool load(snapshot_reader& r)
+	{
+		auto size = uint64_t{};
+		auto state = uint32_t{};
+		auto num_emitters = uint32_t{};
+		if (!r.read(size) || !r.read(state) || !r.read(num_emitters) || size > m_capacity || num_emitters != m_emitters.size())
+			return r.fail();
+
+		for (auto& em : m_emitters)
+		{
+			auto active = uint32_t{};
+			if (!r.read(em.position) || !r.read(em.carry) || !r.read(active))
+				return r.fail();
+			em.active = active != 0;
+		}
+
+		auto ok = true;
+		m_size = static_cast<size_t>(size);
+		for_each_array([this, &r, &ok](auto& a) { ok = ok && r.read(a.data(), m_size); });
+		for (size_t i = 0; ok && i < m_size; i++)
+		{
+			ok = m_emitter[i] < m_emitters.size();
+		}
+		if (!ok)
+		{
+			m_size = 0;
+			return r.fail();
+		}
+
+		m_rng.set_state(state);
+		return true;
+	}
+
+private:
+	struct emitter
+	{
+		emitter_config config;
+		vecf position;
+		float carry;	// fraction of a particle owed from previous updates
+		bool active;
+		bool reported;	// its visual could not be drawn
+	};
+
+	struct source
+	{
+		SDL_Texture* texture;
+		SDL_Surface* surface;	// used instead of texture without SDL_RenderGeometry
+		SDL_Rect rect;
+		float texture_w;
+		float texture_h;
+	};
+
+	template <typename Fn>
+	void for_each_array(Fn&& fn)
+	{
+		fn(m_position_x); fn(m_position_y);
+		fn(m_velocity_x); fn(m_velocity_y);
+		fn(m_acceleration_x); fn(m_acceleration_y);
+		fn(m_age); fn(m_age_rate);
+		fn(m_emitter);
+	}
+
+	template <typename Fn>
+	void for_each_array(Fn&& fn) const
+	{
+		fn(m_position_x); fn(m_position_y);
+		fn(m_velocity_x); fn(m_velocity_y);
+		fn(m_acceleration_x); fn(m_acceleration_y);
+		fn(m_age); fn(m_age_rate);
+		fn(m_emitter);
+	}
+
+	// Calls fn(x, y, w, h, color) in pixels for every particle of the
+	// emitters in m_emitter_order[first, last).
+	template <typename Fn>
+	void for_each_quad(size_t first, size_t last, vecf camera, vecf unit, Fn&& fn) const
+	{
+		auto const lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+
+		for (auto k = first; k < last; k++)
+		{
+			auto const e = m_emitter_order[k];
+			auto const& cfg = m_emitters[e].config;
+			auto const& c0 = cfg.color_start;
+			auto const& c1 = cfg.color_end;
+
+			for (auto j = m_first[e]; j < m_first[e + 1]; j++)
+			{
+				auto const i = m_order[j];
+				auto const t = m_age[i];
+				auto const s = lerp(cfg.size_start, cfg.size_end, t);
+				auto const color = SDL_Color{
+					static_cast<Uint8>(lerp(c0.r, c1.r, t)), static_cast<Uint8>(lerp(c0.g, c1.g, t)),
+					static_cast<Uint8>(lerp(c0.b, c1.b, t)), static_cast<Uint8>(lerp(c0.a, c1.a, t))
+				};
+				fn((m_position_x[i] - 0.5f * s - camera.x) * unit.x, (m_position_y[i] - 0.5f * s - camera.y) * unit.y, s * unit.x, s * unit.y, color, m_sources[e]);
+			}
+		}
+	}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	void draw_run(context& c, SDL_Texture& t, size_t first, size_t last, vecf camera, vecf unit)
+	{
+		auto v = m_vertices.data();
+		for_each_quad(first, last, camera, unit, [&v](float x, float y, float w, float h, SDL_Color color, source const& s)
+		{
+			auto const u0 = s.rect.x / s.texture_w;
+			auto const v0 = s.rect.y / s.texture_h;
+			auto const u1 = (s.rect.x + s.rect.w) / s.texture_w;
+			auto const v1 = (s.rect.y + s.rect.h) / s.texture_h;
+
+			*v++ = SDL_Vertex{ SDL_FPoint{ x, y }, color, SDL_FPoint{ u0, v0 } };
+			*v++ = SDL_Vertex{ SDL_FPoint{ x + w, y }, color, SDL_FPoint{ u1, v0 } };
+			*v++ = SDL_Vertex{ SDL_FPoint{ x + w, y + h }, color, SDL_FPoint{ u1, v1 } };
+			*v++ = SDL_Vertex{ SDL_FPoint{ x, y + h }, color, SDL_FPoint{ u0, v1 } };
+		});
+
+		auto const num_vertices = static_cast<int>(v - m_vertices.data());
+		c.render_geometry(t, m_vertices.data(), num_vertices, m_indices.data(), num_vertices / 4 * 6);
+	}
+
+	std::vector<SDL_Vertex> m_vertices;
+
+	// the same two triangles per quad for every run, built once
+	std::vector<int> m_indices;
+#else
+	// Without SDL_RenderGeometry the particles are tinted and blended on the
+	// CPU through a streaming_canvas, so all particles cost one draw call and
+	// no shared texture has its modulation changed. Visuals need an RGBA32
+	// surface in the context (context::add_surface); atlas pages are not read.
+	void composite(context& c, vecf camera, vecf unit)
+	{
+		auto const dest_of = [](float x, float y, float w, float h)
+		{
+			return SDL_Rect{ static_cast<int>(x), static_cast<int>(y), static_cast<int>(w), static_cast<int>(h) };
+		};
+
+		// area covered by the particles
+		auto const ws = c.get_window_size();
+		auto x0 = ws.first, y0 = ws.second, x1 = 0, y1 = 0;
+		for_each_quad(0, m_emitter_order.size(), camera, unit, [&](float x, float y, float w, float h, SDL_Color, source const& s)
+		{
+			auto const d = dest_of(x, y, w, h);
+			if (!s.surface || d.w <= 0 || d.h <= 0)
+				return;
+
+			x0 = std::min(x0, std::max(d.x, 0));
+			y0 = std::min(y0, std::max(d.y, 0));
+			x1 = std::max(x1, std::min(d.x + d.w, ws.first));
+			y1 = std::max(y1, std::min(d.y + d.h, ws.second));
+		});
+		if (!m_canvas.begin(c, SDL_Rect{ x0, y0, x1 - x0, y1 - y0 }))
+			return;
+
+		for_each_quad(0, m_emitter_order.size(), camera, unit, [&](float x, float y, float w, float h, SDL_Color color, source const& s)
+		{
+			if (s.surface)
+				m_canvas.blend(*s.surface, s.rect, dest_of(x, y, w, h), color);
+		});
+		m_canvas.end(c);
+	}
+
+	streaming_canvas m_canvas;
+#endif
+
+	size_t m_capacity;
+
+	size_t m_size = 0;
+
+	uint64_t m_dropped = 0;
+
+	xorshift_rng m_rng;
+
+	std::vector<emitter> m_emitters;
+
+	std::vector<float> m_position_x;
+	std::vector<float> m_position_y;
+	std::vector<float> m_velocity_x;
+	std::vector<float> m_velocity_y;
+	std::vector<float> m_acceleration_x;
+	std::vector<float> m_acceleration_y;
+	std::vector<float> m_age;
+	std::vector<float> m_age_rate;		// 1 / lifetime
+	std::vector<uint32_t> m_emitter;
+
+	// draw() scratch
+	std::vector<source> m_sources;
+	std::vector<uint32_t> m_first;
+	std::vector<uint32_t> m_slot;
+	std::vector<uint32_t> m_order;
+	std::vector<uint32_t> m_emitter_order;
+};
+
+}}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "sdl.h"
+#include "tile_map.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Tiles with physical id 0 can be walked through.
+inline bool walkable(tile_map const& map, int x, int y)
+{
+	return map.contains(x, y) && map.physical_at(x, y) == 0;
+}
+
+constexpr static auto unreachable = uint32_t{ 0xffffffff };
+
+struct path_step
+{
+	int dx;
+	int dy;
+	uint32_t cost;
+};
+
+// 8-connected moves; straight steps cost 10 and diagonal ones 14.
+constexpr static path_step path_steps[8] =
+{
+	{ 1, 0, 10 }, { -1, 0, 10 }, { 0, 1, 10 }, { 0, -1, 10 },
+	{ 1, 1, 14 }, { -1, 1, 14 }, { 1, -1, 14 }, { -1, -1, 14 },
+};
+
+// Diagonal moves may not cut the corner of a solid tile.
+inline bool can_step(tile_map const& map, int x, int y, path_step const& s)
+{
+	if (!walkable(map, x + s.dx, y + s.dy))
+		return false;
+	return s.dx == 0 || s.dy == 0 || (walkable(map, x + s.dx, y) && walkable(map, x, y + s.dy));
+}
+
+// Distances to one goal tile over an area of the map, plus the step every
+// tile in it should take to get closer. Built once and then shared by all
+// agents heading for that goal, so looking up a move is O(1) per agent.
+class flow_field
+{
+public:
+	constexpr static auto no_step = uint8_t{ 0xff };
+
+	// area is clipped to the map; agents outside it get no direction.
+	void build(tile_map const& map, veci goal, SDL_Rect area)
+	{
+		auto const bounds = SDL_Rect{ 0, 0, map.width(), map.height() };
+		if (!SDL_IntersectRect(&area, &bounds, &m_area))
+			m_area = SDL_Rect{ 0, 0, 0, 0 };
+		m_goal = goal;
+
+		auto const n = static_cast<size_t>(m_area.w) * m_area.h;
+		m_cost.assign(n, unreachable);
+		m_next.assign(n, uint8_t{ no_step });
+		remember_chunks(map);
+
+		if (!in_area(goal.x, goal.y) || !walkable(map, goal.x, goal.y))
+			return;
+
+		// Dijkstra outwards from the goal
+		using item = std::pair<uint32_t, uint32_t>;
+		std::priority_queue<item, std::vector<item>, std::greater<item>> open;
+		m_cost[index(goal.x, goal.y)] = 0;
+		open.push(item{ 0, static_cast<uint32_t>(index(goal.x, goal.y)) });
+		while (!open.empty())
+		{
+			auto const top = open.top();
+			open.pop();
+			if (top.first != m_cost[top.second])
+				continue;
+
+			auto const x = m_area.x + static_cast<int>(top.second % m_area.w);
+			auto const y = m_area.y + static_cast<int>(top.second / m_area.w);
+			for (auto const& s : path_steps)
+			{
+				if (!in_area(x + s.dx, y + s.dy) || !can_step(map, x, y, s))
+					continue;
+
+				auto const i = index(x + s.dx, y + s.dy);
+				if (top.first + s.cost < m_cost[i])
+				{
+					m_cost[i] = top.first + s.cost;
+					open.push(item{ m_cost[i], static_cast<uint32_t>(i) });
+				}
+			}
+		}
+
+		// every tile points at its cheapest neighbour
+		for (int y = m_area.y; y < m_area.y + m_area.h; y++)
+		{
+			for (int x = m_area.x; x < m_area.x + m_area.w; x++)
+			{
+				auto const i = index(x, y);
+				if (m_cost[i] == unreachable || m_cost[i] == 0)
+					continue;
+
+				auto best = m_cost[i];
+				for (uint8_t d = 0; d < 8; d++)
+				{
+					auto const& s = path_steps[d];
+					if (!in_area(x + s.dx, y + s.dy) || !can_step(map, x, y, s))
+						continue;
+
+					auto const c = m_cost[index(x + s.dx, y + s.dy)];
+					if (c < best)
+					{
+						best = c;
+						m_next[i] = d;
+					}
+				}
+			}
+		}
+	}
+
+	// True once a tile in one of the field's chunks changed, or a chunk was
+	// streamed in or out, since build().
+	bool stale(tile_map const& map) const
+	{
+		size_t k = 0;
+		for (int cy = m_chunks_area.y; cy < m_chunks_area.y + m_chunks_area.h; cy++)
+		{
+			for (int cx = m_chunks_area.x; cx < m_chunks_area.x + m_chunks_area.w; cx++, k++)
+			{
+				auto const c = map.chunk_at(cx, cy);
+				if (c != m_chunks[k].chunk || (c && c->revision != m_chunks[k].revision))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	veci goal() const noexcept { return m_goal; }
+
+	SDL_Rect area() const noexcept { return m_area; }
+
+	bool in_area(int x, int y) const noexcept
+	{
+		return x >= m_area.x && y >= m_area.y && x < m_area.x + m_area.w && y < m_area.y + m_area.h;
+	}
+
+	// Path cost to the goal, unreachable outside the area.
+	uint32_t cost(int x, int y) const { return in_area(x, y) ? m_cost[index(x, y)] : unreachable; }
+
+	// Tile offset to move by; zero at the goal and where it cannot be reached.
+	veci step(int x, int y) const
+	{
+		auto const d = in_area(x, y) ? m_next[index(x, y)] : uint8_t{ no_step };
+		return d == no_step ? veci{ 0, 0 } : veci{ path_steps[d].dx, path_steps[d].dy };
+	}
+
+	// Unit vector towards the next tile.
+	vecf direction(int x, int y) const
+	{
+		auto const s = step(x, y);
+		auto const len = std::sqrt(static_cast<float>(s.x * s.x + s.y * s.y));
+		return len > 0.0f ? vecf{ s.x / len, s.y / len } : vecf{ 0.0f, 0.0f };
+	}
+
+private:
+	struct chunk_version
+	{
+		tile_chunk const* chunk;
+		uint32_t revision;
+	};
+
+	size_t index(int x, int y) const { return static_cast<size_t>(y - m_area.y) * m_area.w + (x - m_area.x); }
+
+	void remember_chunks(tile_map const& map)
+	{
+		m_chunks.clear();
+		m_chunks_area = SDL_Rect{ 0, 0, 0, 0 };
+		if (!m_area.w || !m_area.h)
+			return;
+
+		m_chunks_area.x = m_area.x / chunk_size;
+		m_chunks_area.y = m_area.y / chunk_size;
+		m_chunks_area.w = (m_area.x + m_area.w - 1) / chunk_size - m_chunks_area.x + 1;
+		m_chunks_area.h = (m_area.y + m_area.h - 1) / chunk_size - m_chunks_area.y + 1;
+		for (int cy = m_chunks_area.y; cy < m_chunks_area.y + m_chunks_area.h; cy++)
+		{
+			for (int cx = m_chunks_area.x; cx < m_chunks_area.x + m_chunks_area.w; cx++)
+			{
+				auto const c = map.chunk_at(cx, cy);
+				m_chunks.push_back(chunk_version{ c, c ? c->revision : 0 });
+			}
+		}
+	}
+
+	SDL_Rect m_area{ 0, 0, 0, 0 };
+
+	veci m_goal{ 0, 0 };
+
+	std::vector<uint32_t> m_cost;
+
+	// index into path_steps per tile
+	std::vector<uint8_t> m_next;
+
+	SDL_Rect m_chunks_area{ 0, 0, 0, 0 };
+
+	std::vector<chunk_version> m_chunks;
+};
+
+// Hands out flow fields by goal tile, building them on first use and again
+// once their chunks change. Holds at most capacity fields and drops the
+// least recently used. A radius limits each field to the square of tiles
+// around its goal; 0 covers the whole map.
+class flow_field_cache
+{
+public:
+	explicit flow_field_cache(size_t capacity = 8, int radius = 0)
+		: m_capacity{ std::max<size_t>(capacity, 1) }
+		, m_radius{ radius }
+	{
+	}
+
+	// The reference stays valid until the field is dropped from the cache.
+	flow_field const& get(tile_map const& map, veci goal)
+	{
+		m_clock++;
+		auto it = std::find_if(m_entries.begin(), m_entries.end(), [&](entry const& e) { return e.goal.x == goal.x && e.goal.y == goal.y; });
+		if (it == m_entries.end())
+		{
+			if (m_entries.size() == m_capacity)
+			{
+				it = std::min_element(m_entries.begin(), m_entries.end(), [](entry const& a, entry const& b) { return a.last_used < b.last_used; });
+			}
+			else
+			{
+				m_entries.push_back(entry{ goal, 0, std::unique_ptr<flow_field>{ new flow_field } });
+				it = m_entries.end() - 1;
+			}
+			it->goal = goal;
+			build(map, *it);
+		}
+		else if (it->field->stale(map))
+		{
+			build(map, *it);
+		}
+
+		it->last_used = m_clock;
+		return *it->field;
+	}
+
+	void clear() { m_entries.clear(); }
+
+	size_t size() const noexcept { return m_entries.size(); }
+
+	// Number of fields built so far, including rebuilds.
+	size_t builds() const noexcept { return m_builds; }
+
+private:
+	struct entry
+	{
+		veci goal;
+		uint64_t last_used;
+		std::unique_ptr<flow_field> field;
+	};
+
+	void build(tile_map const& map, entry& e)
+	{
+		auto const area = m_radius > 0
+			? SDL_Rect{ e.goal.x - m_radius, e.goal.y - m_radius, 2 * m_radius + 1, 2 * m_radius + 1 }
+			: SDL_Rect{ 0, 0, map.width(), map.height() };
+		e.field->build(map, e.goal, area);
+		m_builds++;
+	}
+
+	size_t m_capacity;
+
+	int m_radius;
+
+	std::vector<entry> m_entries;
+
+	uint64_t m_clock = 0;
+
+	size_t m_builds = 0;
+};
+
+// A* for single agents, over the same moves and costs as flow_field. Keeps
+// its scratch containers between searches.
+class path_finder
+{
+public:
+	// Fills path with the tiles after start up to and including goal. Gives
+	// up after expanding max_nodes tiles.
+	bool find_path(tile_map const& map, veci start, veci goal, std::vector<veci>& path, size_t max_nodes = 1 << 16)
+	{
+		path.clear();
+		if (!walkable(map, start.x, start.y) || !walkable(map, goal.x, goal.y))
+			return false;
+
+		m_nodes.clear();
+		m_open.clear();
+
+		auto const heuristic = [&](int x, int y)
+		{
+			// octile distance, admissible for 10/14 step costs
+			auto const dx = static_cast<uint32_t>(std::abs(x - goal.x));
+			auto const dy = static_cast<uint32_t>(std::abs(y - goal.y));
+			return 10 * std::max(dx, dy) + 4 * std::min(dx, dy);
+		};
+
+		m_nodes[key(start.x, start.y)] = node{ 0, key(start.x, start.y), false };
+		push(open_item{ heuristic(start.x, start.y), 0, start.x, start.y });
+
+		size_t expanded = 0;
+		while (!m_open.empty() && expanded < max_nodes)
+		{
+			std::pop_heap(m_open.begin(), m_open.end(), std::greater<open_item>{});
+			auto const top = m_open.back();
+			m_open.pop_back();
+
+			auto& n = m_nodes[key(top.x, top.y)];
+			if (n.closed || top.g != n.g)
+				continue;
+			n.closed = true;
+			expanded++;
+
+			if (top.x == goal.x && top.y == goal.y)
+			{
+				for (auto k = key(goal.x, goal.y); k != key(start.x, start.y); k = m_nodes[k].parent)
+				{
+					path.push_back(veci{ static_cast<int32_t>(k & 0xffffffff), static_cast<int32_t>(k >> 32) });
+				}
+				std::reverse(path.begin(), path.end());
+				return true;
+			}
+
+			for (auto const& s : path_steps)
+			{
+				auto const x = top.x + s.dx;
+				auto const y = top.y + s.dy;
+				if (!can_step(map, top.x, top.y, s))
+					continue;
+
+				auto const g = top.g + s.cost;
+				auto const it = m_nodes.find(key(x, y));
+				if (it != m_nodes.end() && (it->second.closed || it->second.g <= g))
+					continue;
+
+				m_nodes[key(x, y)] = node{ g, key(top.x, top.y), false };
+				push(open_item{ g + heuristic(x, y), g, x, y });
+			}
+		}
+		return false;
+	}
+
+private:
+	struct node
+	{
+		uint32_t g;
+		uint64_t parent;
+		bool closed;
+	};
+
+	struct open_item
+	{
+		uint32_t f;
+		uint32_t g;
+		int x;
+		int y;
+
+		bool operator>(open_item const& o) const { return f != o.f ? f > o.f : g < o.g; }
+	};
+
+	static uint64_t key(int x, int y) { return (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x); }
+
+	void push(open_item const& i)
+	{
+		m_open.push_back(i);
+		std::push_heap(m_open.begin(), m_open.end(), std::greater<open_item>{});
+	}
+
+	std::unordered_map<uint64_t, node> m_nodes;
+
+	std::vector<open_item> m_open;
+};
+
+}}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace es { namespace sdl {
+
+enum class frame_phase : uint8_t
+{
+	input,
+	update,
+	render,		// draw submission
+	present,	// SDL_RenderPresent
+	sleep,		// frame pacing
+	count,
+};
+
+constexpr static auto num_frame_phases = static_cast<size_t>(frame_phase::count);
+
+inline char const* to_string(frame_phase p)
+{
+	static char const* const names[] = { "input", "update", "render", "present", "sleep" };
+	return p < frame_phase::count ? names[static_cast<size_t>(p)] : "unknown";
+}
+
+struct frame_sample
+{
+	uint64_t frame;
+	int64_t start_ns;	// since the profiler was created
+	int64_t total_ns;
+	std::array<int64_t, num_frame_phases> phase_start_ns;
+	std::array<int64_t, num_frame_phases> phase_ns;
+};
+
+struct phase_stats
+{
+	float min_ms;
+	float avg_ms;
+	float p99_ms;
+};
+
+// Records per-frame phase timings into a fixed ring of the most recent
+// frames. The render thread is the only writer; any thread may read through
+// snapshot(), stats() or write_chrome_trace() without locking. Each slot is
+// guarded by a sequence number and torn reads are dropped; samples are kept
+// as atomic words so that a torn read is never a data race.
+class frame_profiler
+{
+public:
+	using clock_t = std::chrono::steady_clock;
+
+	// capacity is rounded up to a power of two.
+	explicit frame_profiler(size_t capacity = 1024)
+		: m_epoch{ clock_t::now() }
+	{
+		size_t n = 1;
+		while (n < capacity) n <<= 1;
+		m_mask = n - 1;
+		m_slots.reset(new slot[n]);
+		reset_current(m_epoch);
+	}
+
+	~frame_profiler()
+	{
+		if (!m_dump_thread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock{ m_dump_mutex };
+			m_dump_stop = true;
+		}
+		m_dump_wake.notify_one();
+		m_dump_thread.join();
+	}
+
+	void record(frame_phase p, clock_t::time_point begin, clock_t::time_point end)
+	{
+		auto const i = static_cast<size_t>(p);
+		if (m_current.phase_start_ns[i] < 0)
+			m_current.phase_start_ns[i] = ns(begin);
+		m_current.phase_ns[i] += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+	}
+
+	// Publishes the current frame and starts the next one.
+	void end_frame()
+	{
+		auto const now = clock_t::now();
+		m_current.total_ns = ns(now) - m_current.start_ns;
+
+		auto const frame = m_current.frame;
+		auto& s = m_slots[frame & m_mask];
+		s.sequence.store(2 * frame + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		uint64_t words[sample_words];
+		std::memcpy(words, &m_current, sizeof(words));
+		for (size_t i = 0; i < sample_words; i++)
+		{
+			s.words[i].store(words[i], std::memory_order_relaxed);
+		}
+		s.sequence.store(2 * frame + 2, std::memory_order_release);
+		m_frames.store(frame + 1, std::memory_order_release);
+
+		// the slow frame is not made slower; the writer thread takes it from here
+		if (m_spike_threshold_ns > 0 && m_current.total_ns > m_spike_threshold_ns)
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_dump_mutex };
+				m_dump_frame = frame;
+				m_dump_frame_ns = m_current.total_ns;
+				m_dump_requested = true;
+			}
+			m_dump_wake.notify_one();
+		}
+
+		reset_current(now);
+		m_current.frame = frame + 1;
+	}
+
+	// Dumps the trace to path whenever a frame takes longer than threshold,
+	// from the first frame on. The file is written on a thread of its own,
+	// started on the first call; spikes during a write are covered by one
+	// more write once it is done. Only frames already in the ring are written.
+	void set_spike_dump(clock_t::duration threshold, std::string path)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_dump_mutex };
+			m_spike_path = std::move(path);
+		}
+		m_spike_threshold_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count();
+
+		if (!m_dump_thread.joinable())
+			m_dump_thread = std::thread{ [this] { dump_spikes(); } };
+	}
+
+	uint64_t frames() const noexcept { return m_frames.load(std::memory_order_acquire); }
+
+	// Copies the most recent frames, oldest first, that started within the
+	// given window before the newest one.
+	std::vector<frame_sample> snapshot(clock_t::duration window = clock_t::duration::max()) const
+	{
+		std::vector<frame_sample> out;
+		auto const head = frames();
+		auto const count = std::min<uint64_t>(head, m_mask + 1);
+		out.reserve(static_cast<size_t>(count));
+
+		for (auto f = head - count; f < head; f++)
+		{
+			auto const& s = m_slots[f & m_mask];
+			auto const before = s.sequence.load(std::memory_order_acquire);
+			uint64_t words[sample_words];
+			for (size_t i = 0; i < sample_words; i++)
+			{
+				words[i] = s.words[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (before == 2 * f + 2 && s.sequence.load(std::memory_order_relaxed) == before)
+			{
+				out.emplace_back();
+				std::memcpy(&out.back(), words, sizeof(words));
+			}
+		}
+
+		if (!out.empty() && window != clock_t::duration::max())
+		{
+			auto const from = out.back().start_ns - std::chrono::duration_cast<std::chrono::nanoseconds>(window).count();
+			out.erase(out.begin(), std::find_if(out.begin(), out.end(), [&](frame_sample const& s) { return s.start_ns >= from; }));
+		}
+		return out;
+	}
+
+	// Statistics of one phase over the frames currently in the ring;
+	// frame_phase::count gives whole-frame times.
+	phase_stats stats(frame_phase p) const
+	{
+		auto const samples = snapshot();
+		if (samples.empty())
+			return phase_stats{ 0.0f, 0.0f, 0.0f };
+
+		std::vector<int64_t> values;
+		values.reserve(samples.size());
+		for (auto const& s : samples)
+		{
+			values.push_back(p == frame_phase::count ? s.total_ns : s.phase_ns[static_cast<size_t>(p)]);
+		}
+
+		auto const p99 = values.begin() + (values.size() * 99) / 100;
+		std::nth_element(values.begin(), p99, values.end());
+		double sum = 0.0;
+		for (auto const v : values)
+			sum += static_cast<double>(v);
+
+		return phase_stats{ *std::min_element(values.begin(), values.end()) / 1e6f, static_cast<float>(sum / values.size() / 1e6), *p99 / 1e6f };
+	}
+
+	// Writes the recorded frames in Chrome's trace_event JSON format, viewable
+	// in chrome://tracing or Perfetto.
+	bool write_chrome_trace(char const* path, clock_t::duration window = clock_t::duration::max()) const
+	{
+		auto const file = std::unique_ptr<FILE, int(*)(FILE*)>{ std::fopen(path, "w"), &std::fclose };
+		if (!file)
+		{
+			printf("Fail | could not open '%s' for writing\n", path);
+			return false;
+		}
+
+		auto const f = file.get();
+		fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		auto first = true;
+		auto const event = [&](char const* name, int64_t start_ns, int64_t dur_ns, uint64_t frame)
+		{
+			fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+				first ? "" : ",\n", name, start_ns / 1e3, dur_ns / 1e3, static_cast<unsigned long long>(frame));
+			first = false;
+		};
+
+		for (auto const& s : snapshot(window))
+		{
+			event("frame", s.start_ns, s.total_ns, s.frame);
+			for (size_t i = 0; i < num_frame_phases; i++)
+			{
+				if (s.phase_start_ns[i] >= 0)
+					event(to_string(static_cast<frame_phase>(i)), s.phase_start_ns[i], s.phase_ns[i], s.frame);
+			}
+		}
+		fprintf(f, "\n]}\n");
+		return true;
+	}
+
+private:
+	static_assert(std::is_trivially_copyable<frame_sample>::value && sizeof(frame_sample) % sizeof(uint64_t) == 0, "frame_sample is copied as 64 bit words");
+
+	constexpr static auto sample_words = sizeof(frame_sample) / sizeof(uint64_t);
+
+	struct slot
+	{
+		std::atomic<uint64_t> sequence{ 0 };
+		std::array<std::atomic<uint64_t>, sample_words> words{};
+	};
+
+	void dump_spikes()
+	{
+		std::unique_lock<std::mutex> lock{ m_dump_mutex };
+		for (;;)
+		{
+			m_dump_wake.wait(lock, [this] { return m_dump_requested || m_dump_stop; });
+			if (m_dump_stop)
+				return;
+
+			m_dump_requested = false;
+			auto const frame = m_dump_frame;
+			auto const frame_ns = m_dump_frame_ns;
+			auto const path = m_spike_path;
+			lock.unlock();
+
+			printf("frame %llu took %.2f ms, writing %s\n", static_cast<unsigned long long>(frame), frame_ns / 1e6, path.c_str());
+			write_chrome_trace(path.c_str());
+			lock.lock();
+		}
+	}
+
+	int64_t ns(clock_t::time_point t) const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_epoch).count();
+	}
+
+	void reset_current(clock_t::time_point start)
+	{
+		m_current.start_ns = ns(start);
+		m_current.total_ns = 0;
+		m_current.phase_start_ns.fill(-1);
+		m_current.phase_ns.fill(0);
+	}
+
+	clock_t::time_point m_epoch;
+
+	std::unique_ptr<slot[]> m_slots;
+
+	uint64_t m_mask;
+
+	std::atomic<uint64_t> m_frames{ 0 };
+
+	frame_sample m_current{};
+
+	int64_t m_spike_threshold_ns = 0;
+
+	// spike dump requests, handed to m_dump_thread
+	std::mutex m_dump_mutex;
+
+	std::condition_variable m_dump_wake;
+
+	std::string m_spike_path;
+
+	uint64_t m_dump_frame = 0;
+
+	int64_t m_dump_frame_ns = 0;
+
+	bool m_dump_requested = false;
+
+	bool m_dump_stop = false;
+
+	std::thread m_dump_thread;
+};
+
+// Adds the time until the end of the scope to a phase of the current frame.
+class profile_scope
+{
+public:
+	profile_scope(frame_profiler& p, frame_phase phase)
+		: m_profiler{ p }
+		, m_phase{ phase }
+		, m_begin{ frame_profiler::clock_t::now() }
+	{
+	}
+
+	profile_scope(profile_scope const&) = delete;
+	profile_scope& operator=(profile_scope const&) = delete;
+
+	~profile_scope() { m_profiler.record(m_phase, m_begin, frame_profiler::clock_t::now()); }
+
+private:
+	frame_profiler& m_profiler;
+	frame_phase m_phase;
+	frame_profiler::clock_t::time_point m_begin;
+};
+
+}}
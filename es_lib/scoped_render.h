@@ -1,6 +1,12 @@
 #pragma once
 
 #include "sdl.h"
+#include "tile_layer.h"
+#include "atlas.h"
+#include "tile_map.h"
+#include "entity_store.h"
+#include "command_buffer.h"
+#include "particles.h"
 #include <chrono>
 #include <thread>
 
@@ -12,42 +18,83 @@ namespace sdl
 struct scoped_render
 {
 	scoped_render(context& c, veci num_blocks = { 0, 0 })
-		: m_context{ c }
+		: m_context{ &c }
 		, m_num_blocks{num_blocks}
+		, m_render_begin{ clock_t::now() }
+	{
+		m_context->begin_render();
+	}
+
+	// Records the frame into commands instead of drawing it. Nothing is
+	// presented at the end of the scope; replay the buffer with
+	// add(command_buffer&) on the thread that owns the renderer. The context
+	// is never touched: window size and textures come from target, which is
+	// resolved on the context's thread before recording starts.
+	scoped_render(record_target const& target, veci num_blocks, command_buffer& record_to)
+		: m_target{ &target }
+		, m_commands{ &record_to }
+		, m_num_blocks{ num_blocks }
+		, m_render_begin{ clock_t::now() }
 	{
-		m_context.begin_render();
 	}
 
 	void add(SDL_Texture& t)
 	{
-		m_context.render_copy(t);
+		auto const ws = window_size();
+		submit(t, nullptr, SDL_Rect{ 0, 0, ws.first, ws.second }, m_layer);
 	}
 
 	void add(SDL_Texture& t, SDL_Rect src, SDL_Rect dest)
 	{
-		m_context.render_copy(t, &src, &dest);
+		submit(t, &src, dest, m_layer);
 	}
 
 	void add_from(SDL_Texture& t, SDL_Rect src)
 	{
-		m_context.render_copy(t, &src, nullptr);
+		auto const ws = window_size();
+		submit(t, &src, SDL_Rect{ 0, 0, ws.first, ws.second }, m_layer);
 	}
 
 	void add_to(SDL_Texture& t, SDL_Rect dest)
 	{
-		m_context.render_copy(t, nullptr, &dest);
+		submit(t, nullptr, dest, m_layer);
+	}
+
+	void add(SDL_Rect r, SDL_Color c)
+	{
+		if (m_commands)
+		{
+			m_commands->record(r, c, m_layer);
+			return;
+		}
+
+		if (m_atlas)
+		{
+			m_atlas->batch().add(r, c, m_layer);
+			return;
+		}
+
+		m_context->fill_rect(r, c);
+	}
+
+	// Draws a recorded frame, sorted by layer and texture.
+	void add(command_buffer& commands)
+	{
+		assert(!m_commands);
+		flush();
+		commands.replay(*m_context);
 	}
 
 	void add_to_background(SDL_Texture& t)
 	{
-		auto const ws = m_context.get_window_size();
+		auto const ws = window_size();
 		add_to(t, SDL_Rect{ 0, 0, ws.first, ws.second });
 	}
 
 	template <int NumH, int NumW>
 	void add(int64_t const (&map) [NumH][NumW])
 	{
-		auto const ws = m_context.get_window_size();
+		auto const ws = window_size();
 		
 		auto unit = std::make_pair(ws.first / NumW, ws.second / NumH);
 
@@ -57,49 +104,155 @@ struct scoped_render
 			{
 				if (auto const visual = static_cast<uint32_t>(map[y][x] >> 32))
 				{
-					add_to(m_context.texture_at(visual), SDL_Rect{ x*unit.first, y*unit.second, unit.first, unit.second });
+					add_visual(visual, SDL_Rect{ x*unit.first, y*unit.second, unit.first, unit.second }, tile_layer_index);
 				}
 			}
 		}
 	}
 
+	// Draws only the tiles of the map that are visible through the camera.
+	void add(tile_map const& map)
+	{
+		assert(m_num_blocks.x && m_num_blocks.y);
+
+		auto const ws = window_size();
+		auto const unit = std::make_pair(ws.first / m_num_blocks.x, ws.second / m_num_blocks.y);
+		auto const offset = std::make_pair(static_cast<int>(m_camera.x * unit.first), static_cast<int>(m_camera.y * unit.second));
+
+		map.for_each_visible(visible_tiles(m_camera, m_num_blocks), [&](int x, int y, uint32_t visual)
+		{
+			add_visual(visual, SDL_Rect{ x*unit.first - offset.first, y*unit.second - offset.second, unit.first, unit.second }, tile_layer_index);
+		});
+	}
+
+	// Tile layers render into their texture, so they cannot be recorded.
+	void add(tile_layer& layer)
+	{
+		assert(!m_commands);
+		layer.refresh(*m_context);
+		add_to(layer.texture(), layer.bounds());
+	}
+
 	void add(sprite const& s)
 	{
 		assert(m_num_blocks.x && m_num_blocks.y);
 
-		auto const ws = m_context.get_window_size();
+		auto const ws = window_size();
 		auto unit = std::make_pair(ws.first / m_num_blocks.x, ws.second / m_num_blocks.y);
 
-		add_to(m_context.texture_at(s.visual), SDL_Rect{ 
-			static_cast<int>(s.position.x * unit.first), static_cast<int>(s.position.y * unit.second), 
+		add_visual(s.visual, SDL_Rect{ 
+			static_cast<int>((s.position.x - m_camera.x) * unit.first), static_cast<int>((s.position.y - m_camera.y) * unit.second), 
 			static_cast<int>(s.size.x * unit.first), static_cast<int>(s.size.y * unit.second) 
-		});
+		}, sprite_layer_index);
+	}
+
+	void add(entity_store const& entities)
+	{
+		assert(m_num_blocks.x && m_num_blocks.y);
+
+		auto const ws = window_size();
+		auto const unit = std::make_pair(static_cast<float>(ws.first / m_num_blocks.x), static_cast<float>(ws.second / m_num_blocks.y));
+
+		auto const px = entities.position_x();
+		auto const py = entities.position_y();
+		auto const sx = entities.size_x();
+		auto const sy = entities.size_y();
+		auto const visual = entities.visual();
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			add_visual(visual[i], SDL_Rect{
+				static_cast<int>((px[i] - m_camera.x) * unit.first), static_cast<int>((py[i] - m_camera.y) * unit.second),
+				static_cast<int>(sx[i] * unit.first), static_cast<int>(sy[i] * unit.second)
+			}, sprite_layer_index);
+		}
+	}
+
+	// Particles draw as tinted geometry, or through a streaming texture with
+	// older SDL, so like tile layers they cannot be recorded.
+	void add(particle_system& particles)
+	{
+		assert(m_num_blocks.x && m_num_blocks.y && !m_commands);
+
+		auto const ws = window_size();
+		auto const unit = vecf{ static_cast<float>(ws.first / m_num_blocks.x), static_cast<float>(ws.second / m_num_blocks.y) };
+
+		flush();
+		particles.draw(*m_context, m_atlas, m_camera, unit);
+	}
+
+	// Visuals found in the atlas are batched per page instead of being copied
+	// one at a time. Other textures and rectangles join the batch too, so
+	// with an atlas the frame is drawn in layer order like recorded commands.
+	// The batch is submitted on flush(): before particles and replayed
+	// commands, and at the end of the frame.
+	void use_atlas(texture_atlas& a) { m_atlas = &a; }
+
+	void flush()
+	{
+		if (m_atlas && !m_atlas->batch().empty())
+		{
+			m_atlas->submit(*m_context);
+		}
 	}
 
 	void set_num_blocks(veci v) { m_num_blocks = v; }
 
-	void set_frames_per_second(uint32_t f) { m_frames_per_second = f; }
+	// Layer of the textures and rectangles added directly. Recorded commands
+	// are drawn in layer order; tile maps use layer 1 and sprites layer 2.
+	void set_layer(uint32_t layer) { m_layer = layer; }
 
-	void wait_for_frame()
+	// Top-left corner of the view in blocks; applies to tile maps and sprites.
+	void set_camera(vecf c) { m_camera = c; }
+
+	// Sets the frame rate of the context's pacer; 0 switches to uncapped.
+	void set_frames_per_second(uint32_t f)
 	{
-		auto const time_between_frames = std::chrono::microseconds(static_cast<int>(1000000.0f / m_frames_per_second));
-		m_last_update = m_context.last_update();
-		auto const next_update_due = m_context.last_update() + time_between_frames;
-		if (clock_t::now() < next_update_due)
+		assert(m_context);
+		auto& pacer = m_context->pacer();
+		if (!f)
 		{
-			std::this_thread::sleep_until(next_update_due - m_context.wait_buffer());
+			pacer.set_mode(pacing_mode::uncapped);
+			return;
 		}
+
+		pacer.set_frames_per_second(f);
+		if (pacer.mode() == pacing_mode::uncapped)
+			pacer.set_mode(pacing_mode::fixed_rate);
+	}
+
+	void wait_for_frame()
+	{
+		assert(m_context);
+		m_last_update = m_context->last_update();
+		m_context->pacer().wait_for_frame();
 	}
 
 	~scoped_render()
 	{
 		using namespace std::chrono;
 
+		if (m_commands)
+			return;
+
+		auto& profiler = m_context->profiler();
+
+		flush();
+		auto const render_end = clock_t::now();
+		profiler.record(frame_phase::render, m_render_begin, render_end);
+
 		wait_for_frame();
-		m_context.end_render();
+		auto const sleep_end = clock_t::now();
+		profiler.record(frame_phase::sleep, render_end, sleep_end);
+
+		m_context->end_render();
+		profiler.record(frame_phase::present, sleep_end, m_context->last_update());
+		profiler.end_frame();
+
+		if (m_context->pacer().mode() != pacing_mode::fixed_rate)
+			return;
 
-		auto const time_between_frames = microseconds(static_cast<int>(1000000.0f / m_frames_per_second));
-		auto const now = m_context.last_update();
+		auto const time_between_frames = duration_cast<microseconds>(m_context->pacer().frame_interval());
+		auto const now = m_context->last_update();
 		bool const lag = now > (m_last_update + time_between_frames);
 			
 		auto const diff = static_cast<float>(duration_cast<microseconds>(now - (m_last_update + time_between_frames)).count());
@@ -117,11 +270,65 @@ struct scoped_render
 	}
 
 private:
-	context& m_context;
+	constexpr static auto tile_layer_index = uint32_t{ 1 };
+	constexpr static auto sprite_layer_index = uint32_t{ 2 };
+
+	void submit(SDL_Texture& t, SDL_Rect* src, SDL_Rect dest, uint32_t layer)
+	{
+		if (m_commands)
+		{
+			m_commands->record(t, src, dest, layer);
+			return;
+		}
+
+		if (m_atlas)
+		{
+			m_atlas->batch().add(t, src, dest, layer);
+			return;
+		}
+
+		m_context->render_copy(t, src, &dest);
+	}
+
+	void add_visual(uint32_t visual, SDL_Rect dest, uint32_t layer)
+	{
+		if (m_atlas && m_atlas->contains(visual))
+		{
+			auto const& entry = m_atlas->at(visual);
+			if (m_commands)
+				m_commands->record(m_atlas->page(entry.page), &entry.rect, dest, layer);
+			else
+				m_atlas->batch().add(entry, dest, layer);
+		}
+		else if (m_target)
+		{
+			if (auto const t = m_target->texture(visual))
+				m_commands->record(*t, nullptr, dest, layer);
+		}
+		else
+		{
+			submit(m_context->texture_at(visual), nullptr, dest, layer);
+		}
+	}
+
+	std::pair<int, int> window_size() const { return m_target ? m_target->window_size : m_context->get_window_size(); }
+
+	// null when recording
+	context* m_context = nullptr;
+
+	// set when recording
+	record_target const* m_target = nullptr;
+
+	// set when recording instead of drawing
+	command_buffer* m_commands = nullptr;
+
+	uint32_t m_layer = 0;
+
+	texture_atlas* m_atlas = nullptr;
 
 	veci	m_num_blocks;
 
-	uint32_t m_frames_per_second = 60;
+	vecf	m_camera{ 0.0f, 0.0f };
 
 	uint32_t m_actual_frame_rate;
 
@@ -129,6 +336,8 @@ private:
 
 	std::chrono::steady_clock::time_point m_last_update;
 
+	clock_t::time_point m_render_begin;
+
 	std::chrono::nanoseconds m_render_duration{ 0 };
 };
 
@@ -3,10 +3,12 @@
 #define SDL_MAIN_HANDLED
 #include <SDL/SDL.h>
 
-#include "asset_map.h"
+#include "blitter.h"
+#include "frame_pacer.h"
+#include "profiler.h"
 #include <memory>
 #include <cassert>
-#include <unordered_map>
+#include <vector>
 #include <chrono>
 
 #define ES_EXPECT_SDL_ZERO(op) if(auto const reported_value = op) \
@@ -41,7 +43,218 @@ using renderer_t = std::unique_ptr<SDL_Renderer, destroy_renderer_t>;
 
 using texture_t = std::unique_ptr<SDL_Texture, destroy_texture_t>;
 
-using texture_map_t = std::unordered_map<std::uint32_t, texture_t>;
+enum class resource_type
+{
+	texture,	// VRAM, estimated from size and format
+	surface,	// RAM
+	count,
+};
+
+// Refers to a loaded resource. Handles to unloaded resources are detected
+// through the generation, even if the id was loaded again since.
+struct resource_handle
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+inline bool operator==(resource_handle a, resource_handle b) { return a.index == b.index && a.generation == b.generation; }
+
+inline bool operator!=(resource_handle a, resource_handle b) { return !(a == b); }
+
+// Textures, and optionally the surfaces they were made from, keyed by the
+// small integer ids used as visuals. Ids map to slots through a flat vector
+// and textures sit in a contiguous array by slot, so a lookup on the draw
+// path is two indexed loads. Resources are reference counted; the one who
+// adds a resource holds the first reference and the last release() unloads
+// it.
+class resource_registry
+{
+public:
+	constexpr static auto no_slot = uint32_t{ 0xffffffff };
+
+	resource_handle add(uint32_t id, texture_t texture, surface_t surface = surface_t{})
+	{
+		if (contains(id))
+			unload(handle_of(id));
+
+		uint32_t index;
+		if (m_free_slots.empty())
+		{
+			index = static_cast<uint32_t>(m_slots.size());
+			m_slots.emplace_back();
+			m_textures.push_back(nullptr);
+		}
+		else
+		{
+			index = m_free_slots.back();
+			m_free_slots.pop_back();
+		}
+
+		if (id >= m_slot_of_id.size())
+			m_slot_of_id.resize(id + 1, uint32_t{ no_slot });
+		m_slot_of_id[id] = index;
+
+		auto& s = m_slots[index];
+		s.id = id;
+		s.refs = 1;
+		s.bytes[static_cast<size_t>(resource_type::texture)] = texture_bytes(texture.get());
+		s.bytes[static_cast<size_t>(resource_type::surface)] = surface ? static_cast<uint64_t>(surface->pitch) * surface->h : 0;
+		for (size_t t = 0; t < num_resource_types; t++)
+			m_bytes[t] += s.bytes[t];
+
+		m_textures[index] = texture.get();
+		s.texture = std::move(texture);
+		s.surface = std::move(surface);
+		return resource_handle{ index, s.generation };
+	}
+
+	bool contains(uint32_t id) const noexcept { return id < m_slot_of_id.size() && m_slot_of_id[id] != no_slot; }
+
+	bool valid(resource_handle h) const noexcept
+	{
+		return h.index < m_slots.size() && m_slots[h.index].generation == h.generation && m_slots[h.index].refs;
+	}
+
+	resource_handle handle_of(uint32_t id) const
+	{
+		assert(contains(id));
+		auto const index = m_slot_of_id[id];
+		return resource_handle{ index, m_slots[index].generation };
+	}
+
+	// Ids without a texture draw the placeholder, reported once per id.
+	SDL_Texture& texture_at(uint32_t id) const
+	{
+		if (contains(id))
+			return *m_textures[m_slot_of_id[id]];
+
+		if (id >= m_missing_reported.size())
+			m_missing_reported.resize(id + 1, false);
+		if (!m_missing_reported[id])
+		{
+			printf("Fail | no texture with id %u\n", id);
+			m_missing_reported[id] = true;
+		}
+		assert(m_placeholder && "texture_at needs a placeholder for missing ids");
+		return *m_placeholder;
+	}
+
+	void set_placeholder(texture_t t) { m_placeholder = std::move(t); }
+
+	SDL_Texture* placeholder() const noexcept { return m_placeholder.get(); }
+
+	SDL_Texture& texture(resource_handle h) const
+	{
+		assert(valid(h));
+		return *m_textures[h.index];
+	}
+
+	// Writes the texture of every id into out, the placeholder where there is
+	// none.
+	void resolve_textures(std::vector<SDL_Texture*>& out) const
+	{
+		out.assign(m_slot_of_id.size(), m_placeholder.get());
+		for (size_t id = 0; id < m_slot_of_id.size(); id++)
+		{
+			if (m_slot_of_id[id] != no_slot)
+				out[id] = m_textures[m_slot_of_id[id]];
+		}
+	}
+
+	// nullptr if the resource was added without its surface.
+	SDL_Surface* surface_at(uint32_t id) const { return contains(id) ? m_slots[m_slot_of_id[id]].surface.get() : nullptr; }
+
+	SDL_Surface* surface(resource_handle h) const
+	{
+		assert(valid(h));
+		return m_slots[h.index].surface.get();
+	}
+
+	void acquire(resource_handle h)
+	{
+		assert(valid(h));
+		m_slots[h.index].refs++;
+	}
+
+	void release(resource_handle h)
+	{
+		assert(valid(h));
+		if (--m_slots[h.index].refs == 0)
+			free_slot(h.index);
+	}
+
+	uint32_t ref_count(resource_handle h) const { return valid(h) ? m_slots[h.index].refs : 0; }
+
+	// Unloads regardless of outstanding references.
+	void unload(resource_handle h)
+	{
+		assert(valid(h));
+		free_slot(h.index);
+	}
+
+	size_t size() const noexcept { return m_slots.size() - m_free_slots.size(); }
+
+	uint64_t memory_usage(resource_type t) const noexcept { return m_bytes[static_cast<size_t>(t)]; }
+
+private:
+	constexpr static auto num_resource_types = static_cast<size_t>(resource_type::count);
+
+	struct slot
+	{
+		texture_t texture;
+		surface_t surface;
+		uint32_t id = 0;
+		uint32_t generation = 0;
+		uint32_t refs = 0;
+		uint64_t bytes[num_resource_types] = {};
+	};
+
+	static uint64_t texture_bytes(SDL_Texture* t)
+	{
+		Uint32 format = 0;
+		int w = 0, h = 0;
+		if (!t || SDL_QueryTexture(t, &format, nullptr, &w, &h) != 0)
+			return 0;
+
+		auto const bpp = SDL_BYTESPERPIXEL(format);
+		return static_cast<uint64_t>(w) * h * (bpp ? bpp : 4);
+	}
+
+	void free_slot(uint32_t index)
+	{
+		auto& s = m_slots[index];
+		for (size_t t = 0; t < num_resource_types; t++)
+		{
+			m_bytes[t] -= s.bytes[t];
+			s.bytes[t] = 0;
+		}
+
+		m_slot_of_id[s.id] = no_slot;
+		m_textures[index] = nullptr;
+		s.texture.reset();
+		s.surface.reset();
+		s.refs = 0;
+		s.generation++;
+		m_free_slots.push_back(index);
+	}
+
+	std::vector<slot> m_slots;
+
+	// by slot, kept apart from the owners for the draw path
+	std::vector<SDL_Texture*> m_textures;
+
+	std::vector<uint32_t> m_free_slots;
+
+	std::vector<uint32_t> m_slot_of_id;
+
+	uint64_t m_bytes[num_resource_types] = {};
+
+	texture_t m_placeholder;
+
+	// by id; texture_at only reports an id once
+	mutable std::vector<bool> m_missing_reported;
+};
 
 auto create_bmp(char const* filename)
 {
@@ -56,9 +269,9 @@ struct veci { int x; int y; };
 
 struct moveable_object
 {
-	vecf position;		// blocks per frame
-	vecf velocity;
-	vecf acceleration;
+	vecf position;		// blocks
+	vecf velocity;		// blocks per second
+	vecf acceleration;	// blocks per second squared
 	vecf size { 1.0, 1.0 };
 };
 
@@ -69,44 +282,113 @@ public:
 	int32_t physical;
 };
 
+struct context_config
+{
+	int width = default_screen_width;
+	int height = default_screen_height;
+
+	// Render into an offscreen surface with the software renderer instead of
+	// opening a window. Needs no video driver, so it works on headless machines.
+	bool headless = false;
+
+	// vsync is only honoured with a window; headless contexts run uncapped.
+	pacing_mode pacing = pacing_mode::fixed_rate;
+
+	uint32_t frames_per_second = 60;
+};
+
 class context
 {
 	friend struct scoped_render;
 
 public:
-	context()
+	explicit context(context_config const& config = context_config{})
 	{
+		m_pacer.set_frames_per_second(config.frames_per_second);
+
+		if (config.headless)
+		{
+			ES_EXPECT_SDL_ZERO(SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS));
+
+			m_target = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, config.width, config.height, 32, SDL_PIXELFORMAT_RGBA32)) };
+			m_renderer = renderer_t{ ES_EXPECT_SDL_PTR(SDL_CreateSoftwareRenderer(m_target.get())) };
+			m_pacer.set_mode(config.pacing == pacing_mode::vsync ? pacing_mode::uncapped : config.pacing);
+			add_placeholder();
+			return;
+		}
+
 		ES_EXPECT_SDL_ZERO(SDL_Init(SDL_INIT_EVERYTHING));
 
-		SDL_Window* win;
-		SDL_Renderer* rend;
+		m_vsync = config.pacing == pacing_mode::vsync;
+		m_window = window_t{ ES_EXPECT_SDL_PTR(SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, config.width, config.height, SDL_WINDOW_SHOWN)) };
+		m_renderer = renderer_t{ ES_EXPECT_SDL_PTR(SDL_CreateRenderer(m_window.get(), -1, m_vsync ? SDL_RENDERER_PRESENTVSYNC : 0)) };
+		m_pacer.set_mode(config.pacing);
+		add_placeholder();
+	}
 
-		ES_EXPECT_SDL_ZERO(SDL_CreateWindowAndRenderer(es::default_screen_width, es::default_screen_height, SDL_WINDOW_SHOWN
-			, &win, &rend));
-		m_window = window_t{ win };
-		m_renderer = renderer_t{ rend };
+	// Switching vsync on or off after creation needs SDL 2.0.18; older
+	// versions fall back to fixed_rate when vsync was not requested up front.
+	void set_pacing(pacing_mode mode)
+	{
+		auto const want_vsync = mode == pacing_mode::vsync;
+		if (want_vsync != m_vsync && m_window)
+		{
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+			ES_EXPECT_SDL_ZERO(SDL_RenderSetVSync(m_renderer.get(), want_vsync ? 1 : 0));
+			m_vsync = want_vsync;
+#else
+			if (want_vsync)
+			{
+				printf("Fail | vsync must be requested in context_config with this SDL version\n");
+				mode = pacing_mode::fixed_rate;
+			}
+#endif
+		}
+		if (want_vsync && !m_window)
+		{
+			mode = pacing_mode::uncapped;
+		}
+		m_pacer.set_mode(mode);
 	}
 
-	auto get_window_surface() const { return SDL_GetWindowSurface(m_window.get()); }
+	frame_pacer& pacer() noexcept { return m_pacer; }
+
+	frame_profiler& profiler() noexcept { return m_profiler; }
+
+	bool headless() const noexcept { return !m_window; }
+
+	auto get_window_surface() const { return m_window ? SDL_GetWindowSurface(m_window.get()) : m_target.get(); }
 
 	auto get_window_size() const
 	{
+		if (!m_window)
+			return std::make_pair(m_target->w, m_target->h);
+
 		int x, y;
 		SDL_GetWindowSize(m_window.get(), &x, &y);
 		return std::make_pair(x, y);
 	}
 
+	// Surface blits go through the software blitter when the formats match
+	// and fall back to SDL_BlitScaled otherwise.
 	void blit_surface(SDL_Surface* s, SDL_Rect src, SDL_Rect dest) const
 	{
-		ES_EXPECT_SDL_ZERO(SDL_BlitScaled(s, &src, ES_EXPECT_SDL_PTR(get_window_surface()), &dest));
+		ES_EXPECT_SDL_ZERO(m_blitter.blit(s, &src, ES_EXPECT_SDL_PTR(get_window_surface()), &dest));
 	}
 
-
 	void blit_surface_to(SDL_Surface* s, SDL_Rect dest) const
 	{
-		ES_EXPECT_SDL_ZERO(SDL_BlitScaled(s, nullptr, ES_EXPECT_SDL_PTR(get_window_surface()), &dest));
+		ES_EXPECT_SDL_ZERO(m_blitter.blit(s, nullptr, ES_EXPECT_SDL_PTR(get_window_surface()), &dest));
+	}
+
+	// Returns the number of quads that failed to draw.
+	size_t blit_surfaces(blit_quad const* quads, size_t n) const
+	{
+		return m_blitter.blit(ES_EXPECT_SDL_PTR(get_window_surface()), quads, n);
 	}
 
+	void set_blit_filter(blit_filter f) noexcept { m_blitter.set_filter(f); }
+
 	void blit_surface_to_background(SDL_Surface* s) const
 	{
 		auto const ws = get_window_size();
@@ -130,6 +412,70 @@ public:
 	void render_copy(SDL_Texture& t, SDL_Rect* src = nullptr, SDL_Rect* dest = nullptr)
 	{
 		ES_EXPECT_SDL_ZERO(SDL_RenderCopy(m_renderer.get(), &t, src, dest));
+		m_draw_calls++;
+	}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	void render_geometry(SDL_Texture& t, SDL_Vertex const* vertices, int num_vertices, int const* indices, int num_indices)
+	{
+		ES_EXPECT_SDL_ZERO(SDL_RenderGeometry(m_renderer.get(), &t, vertices, num_vertices, indices, num_indices));
+		m_draw_calls++;
+	}
+#endif
+
+	void fill_rect(SDL_Rect const& r, SDL_Color c)
+	{
+		Uint8 cr, cg, cb, ca;
+		SDL_GetRenderDrawColor(m_renderer.get(), &cr, &cg, &cb, &ca);
+		SDL_SetRenderDrawColor(m_renderer.get(), c.r, c.g, c.b, c.a);
+		ES_EXPECT_SDL_ZERO(SDL_RenderFillRect(m_renderer.get(), &r));
+		SDL_SetRenderDrawColor(m_renderer.get(), cr, cg, cb, ca);
+		m_draw_calls++;
+	}
+
+	texture_t create_target_texture(int w, int h)
+	{
+		texture_t t{ ES_EXPECT_SDL_PTR(SDL_CreateTexture(m_renderer.get(), SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, w, h)) };
+		ES_EXPECT_SDL_ZERO(SDL_SetTextureBlendMode(t.get(), SDL_BLENDMODE_BLEND));
+		return t;
+	}
+
+	// RGBA32, blended, for pixels written with SDL_LockTexture every frame.
+	texture_t create_streaming_texture(int w, int h)
+	{
+		texture_t t{ ES_EXPECT_SDL_PTR(SDL_CreateTexture(m_renderer.get(), SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, w, h)) };
+		ES_EXPECT_SDL_ZERO(SDL_SetTextureBlendMode(t.get(), SDL_BLENDMODE_BLEND));
+		return t;
+	}
+
+	// nullptr restores the window as the render target
+	void set_render_target(SDL_Texture* t)
+	{
+		ES_EXPECT_SDL_ZERO(SDL_SetRenderTarget(m_renderer.get(), t));
+	}
+
+	// Resets the given area of the current render target to fully transparent.
+	// A null rect clears the whole target.
+	void clear_transparent(SDL_Rect const* r = nullptr)
+	{
+		Uint8 cr, cg, cb, ca;
+		SDL_BlendMode mode;
+		SDL_GetRenderDrawColor(m_renderer.get(), &cr, &cg, &cb, &ca);
+		SDL_GetRenderDrawBlendMode(m_renderer.get(), &mode);
+
+		SDL_SetRenderDrawColor(m_renderer.get(), 0, 0, 0, 0);
+		SDL_SetRenderDrawBlendMode(m_renderer.get(), SDL_BLENDMODE_NONE);
+		if (r)
+		{
+			ES_EXPECT_SDL_ZERO(SDL_RenderFillRect(m_renderer.get(), r));
+		}
+		else
+		{
+			ES_EXPECT_SDL_ZERO(SDL_RenderClear(m_renderer.get()));
+		}
+
+		SDL_SetRenderDrawBlendMode(m_renderer.get(), mode);
+		SDL_SetRenderDrawColor(m_renderer.get(), cr, cg, cb, ca);
 	}
 
 	~context()
@@ -137,28 +483,80 @@ public:
 		SDL_Quit();
 	}
 
-	void add_texture(std::uint32_t id, surface_t const& surface)
+	texture_t create_texture(SDL_Surface* surface)
+	{
+		return texture_t{ ES_EXPECT_SDL_PTR(SDL_CreateTextureFromSurface(m_renderer.get(), surface)) };
+	}
+
+	resource_handle add_texture(std::uint32_t id, surface_t const& surface)
+	{
+		return m_resources.add(id, create_texture(surface.get()));
+	}
+
+	// Keeps the surface next to the texture for CPU-side access.
+	resource_handle add_surface(std::uint32_t id, surface_t surface)
+	{
+		auto texture = create_texture(surface.get());
+		return m_resources.add(id, std::move(texture), std::move(surface));
+	}
+
+	veci max_texture_size() const
 	{
-		texture_t t{ ES_EXPECT_SDL_PTR(SDL_CreateTextureFromSurface(m_renderer.get(), surface.get())) };
-		m_texture_map.emplace(id, std::move(t));
+		SDL_RendererInfo info{};
+		ES_EXPECT_SDL_ZERO(SDL_GetRendererInfo(m_renderer.get(), &info));
+		return veci{ info.max_texture_width, info.max_texture_height };
 	}
 
-	SDL_Texture& texture_at(std::uint32_t id) { return *m_texture_map.at(id); }
+	SDL_Texture& texture_at(std::uint32_t id) { return m_resources.texture_at(id); }
+
+	bool has_texture(std::uint32_t id) const { return m_resources.contains(id); }
+
+	resource_registry& resources() noexcept { return m_resources; }
+
+	resource_registry const& resources() const noexcept { return m_resources; }
 
 	auto const& last_update() const noexcept { return m_last_update; }
 
-	auto& wait_buffer() noexcept { return m_wait_buffer; }
+
+	// Number of copy/geometry submissions since the context was created.
+	uint64_t draw_calls() const noexcept { return m_draw_calls; }
 
 private:
+	// Magenta, so a missing visual stands out instead of crashing.
+	void add_placeholder()
+	{
+		auto s = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, 1, 1, 32, SDL_PIXELFORMAT_RGBA32)) };
+		ES_EXPECT_SDL_ZERO(SDL_FillRect(s.get(), nullptr, SDL_MapRGBA(s->format, 255, 0, 255, 255)));
+		m_resources.set_placeholder(create_texture(s.get()));
+	}
+
 	window_t m_window;
 
+	// Offscreen render target of a headless context; must outlive m_renderer.
+	surface_t m_target;
+
 	renderer_t m_renderer;
 
-	texture_map_t m_texture_map;
+	resource_registry m_resources;
 
 	std::chrono::steady_clock::time_point m_last_update;
 
-	std::chrono::microseconds m_wait_buffer{ 1500 };
+	frame_pacer m_pacer;
+
+	frame_profiler m_profiler;
+
+	// Whether presenting currently waits for the display.
+	bool m_vsync = false;
+
+	uint64_t m_draw_calls = 0;
+
+	// scratch buffers only, so blits stay const
+	mutable software_blitter m_blitter;
 };
 
+inline SDL_Surface* get_visual_as_surface(context const& c, int32_t visual)
+{
+	return c.resources().surface_at(static_cast<uint32_t>(visual));
+}
+
 }}
@@ -0,0 +1,498 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Snapshot layout, little-endian:
+//
+//	snapshot_header
+//	sections, each a snapshot_section followed by size bytes
+//
+// Sections are written and read back in order, so a restore is a single
+// pass over the buffer. Section contents are up to their owners, usually a
+// save()/load() pair on the class being saved.
+struct snapshot_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t size;		// of the whole buffer, header included
+};
+
+struct snapshot_section
+{
+	uint32_t tag;
+	uint32_t size;
+};
+
+constexpr static char snapshot_magic[4] = { 'E', 'S', 'S', 'N' };
+
+constexpr static auto snapshot_version = uint32_t{ 1 };
+
+constexpr uint32_t snapshot_tag(char a, char b, char c, char d)
+{
+	return static_cast<uint32_t>(static_cast<uint8_t>(a)) | static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8
+		| static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24;
+}
+
+// Appends sections to a byte buffer. The buffer is cleared but keeps its
+// capacity, so writing into the same buffer every tick stops allocating
+// once it has grown to the size of the state.
+//
+//	snapshot_writer w{ buffer };
+//	w.begin(snapshot_tag('E', 'N', 'T', 'S'));
+//	entities.save(w);
+//	w.end();
+//	w.finish();
+class snapshot_writer
+{
+public:
+	explicit snapshot_writer(std::vector<uint8_t>& out)
+		: m_out{ out }
+	{
+		m_out.clear();
+		auto header = snapshot_header{};
+		std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+		header.version = snapshot_version;
+		write(header);
+	}
+
+	void begin(uint32_t tag)
+	{
+		assert(m_section == no_section);
+		m_section = m_out.size();
+		write(snapshot_section{ tag, 0 });
+	}
+
+	void end()
+	{
+		assert(m_section != no_section);
+		auto const size = m_out.size() - m_section - sizeof(snapshot_section);
+		assert(size <= UINT32_MAX);
+		auto const size32 = static_cast<uint32_t>(size);
+		std::memcpy(m_out.data() + m_section + offsetof(snapshot_section, size), &size32, sizeof(size32));
+		m_section = no_section;
+	}
+
+	template <typename T>
+	void write(T const& v)
+	{
+		write(&v, 1);
+	}
+
+	template <typename T>
+	void write(T const* p, size_t n)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "snapshots hold plain data only");
+		auto const at = m_out.size();
+		m_out.resize(at + sizeof(T) * n);
+		if (n)
+			std::memcpy(m_out.data() + at, p, sizeof(T) * n);
+	}
+
+	// Element count followed by the elements.
+	template <typename T>
+	void write_vector(std::vector<T> const& v)
+	{
+		write(static_cast<uint64_t>(v.size()));
+		write(v.data(), v.size());
+	}
+
+	// Stores the final size in the header. Call once after the last section.
+	void finish()
+	{
+		assert(m_section == no_section);
+		auto const size = static_cast<uint64_t>(m_out.size());
+		std::memcpy(m_out.data() + offsetof(snapshot_header, size), &size, sizeof(size));
+	}
+
+	size_t size() const noexcept { return m_out.size(); }
+
+private:
+	constexpr static auto no_section = SIZE_MAX;
+
+	std::vector<uint8_t>& m_out;
+
+	size_t m_section = no_section;
+};
+
+// Reads a snapshot front to back. Every read fails once anything is out of
+// bounds or malformed, so callers can chain reads and check once.
+//
+//	snapshot_reader r{ buffer };
+//	uint32_t tag;
+//	while (r.next(tag))
+//	{
+//		if (tag == snapshot_tag('E', 'N', 'T', 'S')) entities.load(r);
+//	}
+//	if (!r.ok()) ...
+class snapshot_reader
+{
+public:
+	snapshot_reader(uint8_t const* data, size_t size)
+		: m_data{ data }
+		, m_end{ size }
+	{
+		auto header = snapshot_header{};
+		if (!read(header) || std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0
+			|| header.version != snapshot_version || header.size != size)
+		{
+			printf("Fail | not a complete version %u snapshot\n", snapshot_version);
+			m_ok = false;
+		}
+		m_section_end = m_at;
+	}
+
+	explicit snapshot_reader(std::vector<uint8_t> const& buffer)
+		: snapshot_reader{ buffer.data(), buffer.size() }
+	{
+	}
+
+	// Moves to the start of the next section, skipping whatever is left of
+	// the current one. Returns false at the end of the snapshot or on errors.
+	bool next(uint32_t& tag)
+	{
+		if (!m_ok)
+			return false;
+
+		m_at = m_section_end;
+		m_limit = m_end;
+		if (m_at == m_end)
+			return false;
+
+		auto section = snapshot_section{};
+		if (!read(section) || section.size > m_end - m_at)
+		{
+			printf("Fail | snapshot section at %zu runs past the end\n", m_at);
+			m_ok = false;
+			return false;
+		}
+
+		tag = section.tag;
+		m_section_end = m_at + section.size;
+		m_limit = m_section_end;
+		return true;
+	}
+
+	template <typename T>
+	bool read(T& v)
+	{
+		return read(&v, 1);
+	}
+
+	template <typename T>
+	bool read(T* p, size_t n)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "snapshots hold plain data only");
+		if (!m_ok || n > (m_limit - m_at) / sizeof(T))
+			return m_ok = false;
+
+		if (n)
+			std::memcpy(p, m_data + m_at, sizeof(T) * n);
+		m_at += sizeof(T) * n;
+		return true;
+	}
+
+	// Resizes v to the stored count; allocates only when v has to grow.
+	template <typename T>
+	bool read_vector(std::vector<T>& v)
+	{
+		auto n = uint64_t{};
+		if (!read(n) || n > (m_limit - m_at) / sizeof(T))
+			return m_ok = false;
+
+		v.resize(static_cast<size_t>(n));
+		return read(v.data(), v.size());
+	}
+
+	// Marks the snapshot as malformed, e.g. when a section's contents do not
+	// fit the object being restored.
+	bool fail() { return m_ok = false; }
+
+	bool ok() const noexcept { return m_ok; }
+
+private:
+	uint8_t const* m_data;
+
+	size_t m_end;
+
+	size_t m_at = 0;
+
+	// reads stop here; the end of the current section
+	size_t m_limit = m_end;
+
+	size_t m_section_end = 0;
+
+	bool m_ok = true;
+};
+
+// Delta layout, little-endian:
+//
+//	snapshot_delta_header
+//	runs, each a snapshot_delta_run followed by the bytes of its blocks
+//
+// A delta holds the blocks of a snapshot that differ from a base snapshot.
+// Snapshots of similar states line up block for block as long as sections
+// are written in the same order and keep their sizes, so deltas between
+// neighbouring ticks are mostly empty.
+struct snapshot_delta_header
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t base_size;
+	uint64_t size;
+	uint64_t base_checksum;
+	uint32_t block_size;
+	uint32_t num_runs;
+};
+
+struct snapshot_delta_run
+{
+	uint32_t first_block;
+	uint32_t num_blocks;
+};
+
+constexpr static char snapshot_delta_magic[4] = { 'E', 'S', 'S', 'D' };
+
+constexpr static auto snapshot_delta_version = uint32_t{ 1 };
+
+// FNV-1a over 8 byte words, enough to catch a delta applied to the wrong base.
+inline uint64_t snapshot_checksum(uint8_t const* data, size_t size)
+{
+	auto h = uint64_t{ 14695981039346656037ull };
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, data + i, sizeof(w));
+		h = (h ^ w) * 1099511628211ull;
+	}
+	for (; i < size; i++)
+	{
+		h = (h ^ data[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+// Writes the blocks of target that differ from base into out.
+inline void make_snapshot_delta(std::vector<uint8_t> const& base, std::vector<uint8_t> const& target, std::vector<uint8_t>& out, uint32_t block_size = 64)
+{
+	assert(block_size > 0);
+
+	auto header = snapshot_delta_header{};
+	std::memcpy(header.magic, snapshot_delta_magic, sizeof(header.magic));
+	header.version = snapshot_delta_version;
+	header.base_size = base.size();
+	header.size = target.size();
+	header.base_checksum = snapshot_checksum(base.data(), base.size());
+	header.block_size = block_size;
+
+	out.resize(sizeof(header));
+
+	auto const num_blocks = (target.size() + block_size - 1) / block_size;
+	auto const block_differs = [&](size_t b)
+	{
+		auto const at = b * block_size;
+		auto const n = std::min<size_t>(block_size, target.size() - at);
+		return at + n > base.size() || std::memcmp(base.data() + at, target.data() + at, n) != 0;
+	};
+
+	for (size_t b = 0; b < num_blocks; )
+	{
+		if (!block_differs(b))
+		{
+			b++;
+			continue;
+		}
+
+		auto last = b + 1;
+		while (last < num_blocks && block_differs(last))
+			last++;
+
+		auto const run = snapshot_delta_run{ static_cast<uint32_t>(b), static_cast<uint32_t>(last - b) };
+		auto const first_byte = b * block_size;
+		auto const num_bytes = std::min(last * block_size, target.size()) - first_byte;
+
+		auto const at = out.size();
+		out.resize(at + sizeof(run) + num_bytes);
+		std::memcpy(out.data() + at, &run, sizeof(run));
+		std::memcpy(out.data() + at + sizeof(run), target.data() + first_byte, num_bytes);
+		header.num_runs++;
+		b = last;
+	}
+
+	std::memcpy(out.data(), &header, sizeof(header));
+}
+
+// Rebuilds the target snapshot of a delta from the base it was made against.
+inline bool apply_snapshot_delta(std::vector<uint8_t> const& base, uint8_t const* delta, size_t delta_size, std::vector<uint8_t>& out)
+{
+	assert(&base != &out);
+
+	auto header = snapshot_delta_header{};
+	if (delta_size < sizeof(header))
+	{
+		printf("Fail | snapshot delta is truncated\n");
+		return false;
+	}
+	std::memcpy(&header, delta, sizeof(header));
+
+	if (std::memcmp(header.magic, snapshot_delta_magic, sizeof(header.magic)) != 0 || header.version != snapshot_delta_version || !header.block_size)
+	{
+		printf("Fail | not a version %u snapshot delta\n", snapshot_delta_version);
+		return false;
+	}
+	if (header.base_size != base.size() || header.base_checksum != snapshot_checksum(base.data(), base.size()))
+	{
+		printf("Fail | snapshot delta was made against another base\n");
+		return false;
+	}
+
+	out.resize(static_cast<size_t>(header.size));
+	std::memcpy(out.data(), base.data(), std::min(base.size(), out.size()));
+
+	auto const malformed = []
+	{
+		printf("Fail | snapshot delta is malformed\n");
+		return false;
+	};
+
+	auto at = sizeof(header);
+	for (uint32_t i = 0; i < header.num_runs; i++)
+	{
+		auto run = snapshot_delta_run{};
+		if (delta_size - at < sizeof(run))
+			return malformed();
+		std::memcpy(&run, delta + at, sizeof(run));
+		at += sizeof(run);
+
+		auto const first_byte = static_cast<uint64_t>(run.first_block) * header.block_size;
+		auto const last_byte = std::min<uint64_t>(first_byte + static_cast<uint64_t>(run.num_blocks) * header.block_size, out.size());
+		if (first_byte >= last_byte || last_byte - first_byte > delta_size - at)
+			return malformed();
+
+		auto const n = static_cast<size_t>(last_byte - first_byte);
+		std::memcpy(out.data() + first_byte, delta + at, n);
+		at += n;
+	}
+
+	return at == delta_size ? true : malformed();
+}
+
+inline bool apply_snapshot_delta(std::vector<uint8_t> const& base, std::vector<uint8_t> const& delta, std::vector<uint8_t>& out)
+{
+	return apply_snapshot_delta(base, delta.data(), delta.size(), out);
+}
+
+// Keeps the most recent per-tick snapshots for rewinding. Every
+// keyframe_interval-th snapshot is stored whole and the ones in between as
+// deltas against it. Entries and their buffers are recycled, so pushing
+// stops allocating once the buffers have grown; when full, the oldest
+// keyframe is dropped together with its deltas.
+class snapshot_history
+{
+public:
+	explicit snapshot_history(size_t capacity = 600, size_t keyframe_interval = 60)
+		: m_entries(capacity)
+		, m_keyframe_interval{ keyframe_interval }
+	{
+		assert(keyframe_interval > 0 && capacity >= keyframe_interval);
+	}
+
+	void push(std::vector<uint8_t> const& snapshot)
+	{
+		if (m_count == m_entries.size())
+		{
+			do
+			{
+				m_first = (m_first + 1) % m_entries.size();
+				m_count--;
+			} while (m_count && !at(0).keyframe);
+		}
+
+		auto const slot = (m_first + m_count) % m_entries.size();
+		auto& e = m_entries[slot];
+		e.keyframe = m_count == 0 || m_since_keyframe >= m_keyframe_interval;
+		if (e.keyframe)
+		{
+			e.data.assign(snapshot.begin(), snapshot.end());
+			m_keyframe = slot;
+			m_since_keyframe = 0;
+		}
+		else
+		{
+			make_snapshot_delta(m_entries[m_keyframe].data, snapshot, e.data);
+		}
+		m_count++;
+		m_since_keyframe++;
+	}
+
+	// Removes the most recent snapshot and rebuilds it into out.
+	bool pop(std::vector<uint8_t>& out)
+	{
+		if (!m_count)
+			return false;
+
+		auto& e = at(m_count - 1);
+		auto ok = true;
+		if (e.keyframe)
+			out.assign(e.data.begin(), e.data.end());
+		else
+			ok = apply_snapshot_delta(m_entries[m_keyframe].data, e.data, out);
+		m_count--;
+
+		// the newest remaining keyframe and how many entries follow it
+		m_since_keyframe = 0;
+		for (auto i = m_count; i-- > 0; )
+		{
+			m_since_keyframe++;
+			if (at(i).keyframe)
+			{
+				m_keyframe = (m_first + i) % m_entries.size();
+				break;
+			}
+		}
+		return ok;
+	}
+
+	size_t size() const noexcept { return m_count; }
+
+	bool empty() const noexcept { return m_count == 0; }
+
+	void clear() noexcept
+	{
+		m_count = 0;
+		m_since_keyframe = 0;
+	}
+
+private:
+	struct entry
+	{
+		bool keyframe;
+		std::vector<uint8_t> data;
+	};
+
+	entry& at(size_t i) { return m_entries[(m_first + i) % m_entries.size()]; }
+
+	std::vector<entry> m_entries;
+
+	size_t m_keyframe_interval;
+
+	size_t m_first = 0;
+
+	size_t m_count = 0;
+
+	// ring index of the newest keyframe, and entries from it to the newest
+	size_t m_keyframe = 0;
+
+	size_t m_since_keyframe = 0;
+};
+
+}}
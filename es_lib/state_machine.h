@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// One row of a transition table: entity i leaves `from` for `to` when
+// guard(context, i) holds. Guards are plain function pointers so tables can
+// be constexpr arrays.
+template <typename State, typename Context>
+struct transition
+{
+	State from;
+	State to;
+	bool (*guard)(Context const&, uint32_t);
+};
+
+// Emitted for every transition taken: the entity exits `from` and enters `to`.
+template <typename State>
+struct state_event
+{
+	uint32_t index;
+	State from;
+	State to;
+};
+
+// Runs a transition table over many entities at once. States are enum
+// values below NumStates; rows are grouped by their `from` state so each
+// entity only looks at its own state's rows, tried in table order. update()
+// visits entities grouped by state, which keeps one state's guards hot
+// instead of jumping between them entity by entity.
+template <typename State, typename Context, size_t NumStates>
+class state_machine
+{
+public:
+	using transition_t = transition<State, Context>;
+	using event_t = state_event<State>;
+
+	template <size_t N>
+	explicit state_machine(transition_t const (&table)[N])
+	{
+		m_first.fill(0);
+		for (auto const& t : table)
+		{
+			assert(index_of(t.from) < NumStates && index_of(t.to) < NumStates && t.guard);
+			m_first[index_of(t.from) + 1]++;
+		}
+		for (size_t s = 0; s < NumStates; s++)
+		{
+			m_first[s + 1] += m_first[s];
+		}
+
+		m_rows.resize(N);
+		auto slot = m_first;
+		for (auto const& t : table)
+		{
+			m_rows[slot[index_of(t.from)]++] = t;
+		}
+	}
+
+	// The state entity i moves to from s, or s if no guard holds.
+	State next(Context const& c, State s, uint32_t i) const
+	{
+		auto const si = index_of(s);
+		for (auto r = m_first[si]; r < m_first[si + 1]; r++)
+		{
+			if (m_rows[r].guard(c, i))
+				return m_rows[r].to;
+		}
+		return s;
+	}
+
+	// Takes at most one transition for each of states[0, n) and returns the
+	// transitions taken, valid until the next call.
+	std::vector<event_t> const& update(Context const& c, State* states, size_t n)
+	{
+		m_events.clear();
+
+		// counting sort of the entity indices by current state
+		std::array<uint32_t, NumStates + 1> first{};
+		for (size_t i = 0; i < n; i++)
+		{
+			first[index_of(states[i]) + 1]++;
+		}
+		for (size_t s = 0; s < NumStates; s++)
+		{
+			first[s + 1] += first[s];
+		}
+
+		m_order.resize(n);
+		auto slot = first;
+		for (size_t i = 0; i < n; i++)
+		{
+			m_order[slot[index_of(states[i])]++] = static_cast<uint32_t>(i);
+		}
+
+		for (size_t s = 0; s < NumStates; s++)
+		{
+			auto const rows_begin = m_first[s];
+			auto const rows_end = m_first[s + 1];
+			if (rows_begin == rows_end)
+				continue;
+
+			for (auto k = first[s]; k < first[s + 1]; k++)
+			{
+				auto const i = m_order[k];
+				for (auto r = rows_begin; r < rows_end; r++)
+				{
+					if (m_rows[r].guard(c, i))
+					{
+						m_events.push_back(event_t{ i, states[i], m_rows[r].to });
+						states[i] = m_rows[r].to;
+						break;
+					}
+				}
+			}
+		}
+		return m_events;
+	}
+
+	size_t num_transitions() const noexcept { return m_rows.size(); }
+
+private:
+	static size_t index_of(State s) { return static_cast<size_t>(s); }
+
+	// rows of state s are m_rows[m_first[s], m_first[s + 1])
+	std::array<uint32_t, NumStates + 1> m_first;
+
+	std::vector<transition_t> m_rows;
+
+	std::vector<uint32_t> m_order;
+
+	std::vector<event_t> m_events;
+};
+
+}}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "sdl.h"
+#include "tile_map.h"
+#include <algorithm>
+#include <vector>
+
+namespace es { namespace sdl {
+
+// Keeps a rendered copy of a static tile map in an offscreen target texture.
+// Cells are only redrawn when their visual changes, so compositing the layer
+// costs a single copy per frame plus one copy per changed cell.
+class tile_layer
+{
+public:
+	explicit tile_layer(veci num_blocks)
+		: m_num_blocks{ num_blocks }
+		, m_cells(static_cast<size_t>(num_blocks.x * num_blocks.y), 0)
+		, m_is_dirty(m_cells.size(), 0)
+	{
+	}
+
+	template <int NumH, int NumW>
+	void assign(int64_t const (&map)[NumH][NumW])
+	{
+		assert(NumW == m_num_blocks.x && NumH == m_num_blocks.y);
+
+		for (int y = 0; y < NumH; y++)
+		{
+			for (int x = 0; x < NumW; x++)
+			{
+				set(x, y, map[y][x]);
+			}
+		}
+	}
+
+	// Copies the tiles of map that the layer covers, e.g. after the map was
+	// restored from a snapshot. Only cells whose visual changed redraw.
+	void assign(tile_map const& map)
+	{
+		for (int y = 0; y < std::min(m_num_blocks.y, map.height()); y++)
+		{
+			for (int x = 0; x < std::min(m_num_blocks.x, map.width()); x++)
+			{
+				set(x, y, int64_t{ map.visual_at(x, y) } << 32 | map.physical_at(x, y));
+			}
+		}
+	}
+
+	void set(int x, int y, int64_t cell)
+	{
+		auto const i = index(x, y);
+		auto const old_visual = visual_of(m_cells[i]);
+		m_cells[i] = cell;
+
+		if (old_visual != visual_of(cell) && !m_is_dirty[i])
+		{
+			m_is_dirty[i] = 1;
+			m_dirty.push_back(i);
+		}
+	}
+
+	int64_t at(int x, int y) const { return m_cells[index(x, y)]; }
+
+	// Forces a full redraw on the next refresh, e.g. after SDL reports that
+	// render targets were reset.
+	void invalidate() noexcept { m_texture.reset(); }
+
+	// Brings the cached texture up to date with the cell contents.
+	void refresh(context& c)
+	{
+		auto const ws = c.get_window_size();
+		auto const unit = veci{ ws.first / m_num_blocks.x, ws.second / m_num_blocks.y };
+
+		bool const resized = unit.x != m_unit.x || unit.y != m_unit.y;
+		if (!m_texture || resized)
+		{
+			m_unit = unit;
+			m_texture = c.create_target_texture(unit.x * m_num_blocks.x, unit.y * m_num_blocks.y);
+			redraw_all(c);
+			return;
+		}
+
+		if (m_dirty.empty())
+			return;
+
+		c.set_render_target(m_texture.get());
+		for (auto const i : m_dirty)
+		{
+			draw_cell(c, i);
+			m_is_dirty[i] = 0;
+		}
+		m_dirty.clear();
+		c.set_render_target(nullptr);
+	}
+
+	SDL_Texture& texture() { assert(m_texture); return *m_texture; }
+
+	SDL_Rect bounds() const { return SDL_Rect{ 0, 0, m_unit.x * m_num_blocks.x, m_unit.y * m_num_blocks.y }; }
+
+private:
+	static uint32_t visual_of(int64_t cell) noexcept { return static_cast<uint32_t>(cell >> 32); }
+
+	size_t index(int x, int y) const
+	{
+		assert(x >= 0 && x < m_num_blocks.x && y >= 0 && y < m_num_blocks.y);
+		return static_cast<size_t>(y * m_num_blocks.x + x);
+	}
+
+	SDL_Rect cell_rect(size_t i) const
+	{
+		auto const x = static_cast<int>(i) % m_num_blocks.x;
+		auto const y = static_cast<int>(i) / m_num_blocks.x;
+		return SDL_Rect{ x*m_unit.x, y*m_unit.y, m_unit.x, m_unit.y };
+	}
+
+	void draw_cell(context& c, size_t i)
+	{
+		auto rect = cell_rect(i);
+		c.clear_transparent(&rect);
+		if (auto const visual = visual_of(m_cells[i]))
+		{
+			c.render_copy(c.texture_at(visual), nullptr, &rect);
+		}
+	}
+
+	void redraw_all(context& c)
+	{
+		c.set_render_target(m_texture.get());
+		c.clear_transparent();
+		for (size_t i = 0; i < m_cells.size(); i++)
+		{
+			if (auto const visual = visual_of(m_cells[i]))
+			{
+				auto rect = cell_rect(i);
+				c.render_copy(c.texture_at(visual), nullptr, &rect);
+			}
+			m_is_dirty[i] = 0;
+		}
+		m_dirty.clear();
+		c.set_render_target(nullptr);
+	}
+
+	veci m_num_blocks;
+
+	veci m_unit{ 0, 0 };
+
+	texture_t m_texture;
+
+	std::vector<int64_t> m_cells;
+
+	std::vector<uint8_t> m_is_dirty;
+
+	std::vector<size_t> m_dirty;
+};
+
+}}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include "sdl.h"
+#include "snapshot.h"
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace es { namespace sdl {
+
+// Tiles per chunk side.
+constexpr static auto chunk_size = int{ 32 };
+
+constexpr static auto chunk_area = chunk_size * chunk_size;
+
+// Visual and physical ids of a chunk_size x chunk_size block of tiles, kept
+// in separate row-major arrays so that renderers and collision each touch
+// only the half they need.
+struct tile_chunk
+{
+	std::array<uint32_t, chunk_area> visual;
+	std::array<uint32_t, chunk_area> physical;
+
+	// Number of tiles with a non-zero visual; chunks without any are skipped
+	// when drawing.
+	uint32_t num_visible;
+
+	// Bumped on every change so that derived data can detect stale chunks.
+	uint32_t revision;
+};
+
+// A tile world of arbitrary size stored as a grid of chunks. Chunks are only
+// allocated once a tile in them is set, so large sparse worlds stay cheap.
+// Tiles outside the map or in unallocated chunks read as 0.
+class tile_map
+{
+public:
+	tile_map(int width, int height)
+		: m_width{ width }
+		, m_height{ height }
+		, m_chunks_x{ (width + chunk_size - 1) / chunk_size }
+		, m_chunks_y{ (height + chunk_size - 1) / chunk_size }
+		, m_chunks(static_cast<size_t>(m_chunks_x) * m_chunks_y)
+	{
+		assert(width > 0 && height > 0);
+	}
+
+	// Converts the packed (visual << 32 | physical) layout used by es::map.
+	template <int NumH, int NumW>
+	static tile_map from(int64_t const (&map)[NumH][NumW])
+	{
+		tile_map m{ NumW, NumH };
+		for (int y = 0; y < NumH; y++)
+		{
+			for (int x = 0; x < NumW; x++)
+			{
+				if (map[y][x])
+					m.set(x, y, static_cast<uint32_t>(map[y][x] >> 32), static_cast<uint32_t>(map[y][x]));
+			}
+		}
+		return m;
+	}
+
+	int width() const noexcept { return m_width; }
+
+	int height() const noexcept { return m_height; }
+
+	int chunks_x() const noexcept { return m_chunks_x; }
+
+	int chunks_y() const noexcept { return m_chunks_y; }
+
+	bool contains(int x, int y) const noexcept { return x >= 0 && y >= 0 && x < m_width && y < m_height; }
+
+	uint32_t visual_at(int x, int y) const noexcept
+	{
+		auto const c = contains(x, y) ? chunk_of(x, y) : nullptr;
+		return c ? c->visual[local_index(x, y)] : 0;
+	}
+
+	uint32_t physical_at(int x, int y) const noexcept
+	{
+		auto const c = contains(x, y) ? chunk_of(x, y) : nullptr;
+		return c ? c->physical[local_index(x, y)] : 0;
+	}
+
+	void set(int x, int y, uint32_t visual, uint32_t physical)
+	{
+		assert(contains(x, y));
+
+		auto const index = chunk_index(x / chunk_size, y / chunk_size);
+		auto& slot = m_chunks[index];
+		if (!slot && !visual && !physical)
+			return;
+
+		note_change(index);
+		if (!slot)
+		{
+			slot.reset(new tile_chunk{});
+		}
+
+		auto const i = local_index(x, y);
+		auto const was_visible = slot->visual[i] != 0;
+		slot->num_visible += (visual != 0) - was_visible;
+		slot->visual[i] = visual;
+		slot->physical[i] = physical;
+		slot->revision++;
+	}
+
+	tile_chunk const* chunk_at(int cx, int cy) const noexcept
+	{
+		if (cx < 0 || cy < 0 || cx >= m_chunks_x || cy >= m_chunks_y)
+			return nullptr;
+		return m_chunks[chunk_index(cx, cy)].get();
+	}
+
+	// Takes a chunk out of the map; its tiles read as 0 until one is
+	// installed again. Not for maps tracking changes, which would miss it.
+	std::unique_ptr<tile_chunk> release_chunk(int cx, int cy)
+	{
+		assert(cx >= 0 && cy >= 0 && cx < m_chunks_x && cy < m_chunks_y);
+		assert(!tracking_changes());
+		return std::move(m_chunks[chunk_index(cx, cy)]);
+	}
+
+	// Replaces a chunk, e.g. one streamed in from disk. num_visible must
+	// match the visuals. Not for maps tracking changes either.
+	void install_chunk(int cx, int cy, std::unique_ptr<tile_chunk> c)
+	{
+		assert(cx >= 0 && cy >= 0 && cx < m_chunks_x && cy < m_chunks_y);
+		assert(!tracking_changes());
+		m_chunks[chunk_index(cx, cy)] = std::move(c);
+	}
+
+	// Starts tracking the chunks set() changes from this state on, e.g. right
+	// after a level is loaded. Snapshots of a tracked map hold only the
+	// changed chunks, and the original of each is kept so that a load can
+	// put back chunks changed after the snapshot. Meant for maps that stay
+	// resident rather than streamed ones.
+	void mark_clean()
+	{
+		m_base.clear();
+		m_base.resize(m_chunks.size());
+		m_changed.assign(m_chunks.size(), 0);
+		m_changed_chunks.clear();
+	}
+
+	bool tracking_changes() const noexcept { return !m_changed.empty(); }
+
+	size_t num_changed_chunks() const noexcept { return m_changed_chunks.size(); }
+
+	// Writes the chunks changed since mark_clean().
+	void save(snapshot_writer& w) const
+	{
+		assert(tracking_changes());
+		w.write(m_width);
+		w.write(m_height);
+		w.write_vector(m_changed_chunks);
+		for (auto const i : m_changed_chunks)
+		{
+			auto const c = m_chunks[i].get();
+			w.write(uint32_t{ c != nullptr });
+			if (c)
+			{
+				// not the revision, which only means something in this process
+				w.write(c->visual);
+				w.write(c->physical);
+				w.write(c->num_visible);
+			}
+		}
+	}
+
+	// Restores the changed chunks of a snapshot and returns all other changed
+	// chunks to their state at mark_clean(). Restored chunks get a new
+	// revision so derived data rebuilds. A malformed snapshot can leave the
+	// map partly restored.
+	bool load(snapshot_reader& r)
+	{
+		assert(tracking_changes());
+
+		int w, h;
+		if (!r.read(w) || !r.read(h) || w != m_width || h != m_height || !r.read_vector(m_loading))
+			return r.fail();
+
+		for (auto const i : m_loading)
+		{
+			if (i >= m_chunks.size())
+				return r.fail();
+
+			note_change(i);
+			m_changed[i] = 2;
+		}
+
+		// changed after the snapshot was taken
+		m_changed_chunks.erase(std::remove_if(m_changed_chunks.begin(), m_changed_chunks.end(), [this](uint32_t i)
+		{
+			if (m_changed[i] == 2)
+				return false;
+
+			restore_chunk(i, m_base[i].get());
+			m_base[i].reset();
+			m_changed[i] = 0;
+			return true;
+		}), m_changed_chunks.end());
+		m_changed_chunks = m_loading;
+
+		for (auto const i : m_loading)
+		{
+			m_changed[i] = 1;
+
+			uint32_t present;
+			if (!r.read(present))
+				return r.fail();
+
+			auto& slot = m_chunks[i];
+			if (!present)
+			{
+				slot.reset();
+				continue;
+			}
+
+			if (!slot)
+				slot.reset(new tile_chunk{});
+			if (!r.read(slot->visual) || !r.read(slot->physical) || !r.read(slot->num_visible))
+				return r.fail();
+			slot->revision++;
+		}
+		return true;
+	}
+
+	// Calls fn(x, y, visual) for every tile with a visual in the given tile
+	// rectangle, visiting only the chunks that intersect it.
+	template <typename Fn>
+	void for_each_visible(SDL_Rect area, Fn&& fn) const
+	{
+		auto const x0 = std::max(area.x, 0);
+		auto const y0 = std::max(area.y, 0);
+		auto const x1 = std::min(area.x + area.w, m_width);
+		auto const y1 = std::min(area.y + area.h, m_height);
+		if (x0 >= x1 || y0 >= y1)
+			return;
+
+		for (int cy = y0 / chunk_size; cy <= (y1 - 1) / chunk_size; cy++)
+		{
+			for (int cx = x0 / chunk_size; cx <= (x1 - 1) / chunk_size; cx++)
+			{
+				auto const c = m_chunks[chunk_index(cx, cy)].get();
+				if (!c || !c->num_visible)
+					continue;
+
+				auto const ox = cx * chunk_size;
+				auto const oy = cy * chunk_size;
+				auto const lx0 = std::max(x0 - ox, 0);
+				auto const lx1 = std::min(x1 - ox, chunk_size);
+				auto const ly0 = std::max(y0 - oy, 0);
+				auto const ly1 = std::min(y1 - oy, chunk_size);
+
+				for (int ly = ly0; ly < ly1; ly++)
+				{
+					auto const row = &c->visual[ly * chunk_size];
+					for (int lx = lx0; lx < lx1; lx++)
+					{
+						if (auto const visual = row[lx])
+							fn(ox + lx, oy + ly, visual);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	size_t chunk_index(int cx, int cy) const noexcept { return static_cast<size_t>(cy) * m_chunks_x + cx; }
+
+	static size_t local_index(int x, int y) noexcept { return static_cast<size_t>((y % chunk_size) * chunk_size + x % chunk_size); }
+
+	tile_chunk const* chunk_of(int x, int y) const noexcept { return m_chunks[chunk_index(x / chunk_size, y / chunk_size)].get(); }
+
+	void note_change(size_t index)
+	{
+		if (m_changed.empty() || m_changed[index])
+			return;
+
+		m_changed[index] = 1;
+		m_changed_chunks.push_back(static_cast<uint32_t>(index));
+		if (m_chunks[index])
+			m_base[index].reset(new tile_chunk(*m_chunks[index]));
+	}
+
+	// Copies base over the chunk, keeping the chunk's allocation; a null
+	// base removes the chunk.
+	void restore_chunk(size_t index, tile_chunk const* base)
+	{
+		auto& slot = m_chunks[index];
+		if (!base)
+		{
+			slot.reset();
+			return;
+		}
+
+		auto const revision = slot ? slot->revision : base->revision;
+		if (!slot)
+			slot.reset(new tile_chunk{});
+		*slot = *base;
+		slot->revision = revision + 1;
+	}
+
+	int m_width;
+
+	int m_height;
+
+	int m_chunks_x;
+
+	int m_chunks_y;
+
+	std::vector<std::unique_ptr<tile_chunk>> m_chunks;
+
+	// Change tracking, empty until mark_clean(): per chunk whether it changed,
+	// its state at mark_clean() if it existed then, and the changed indices.
+	std::vector<uint8_t> m_changed;
+
+	std::vector<std::unique_ptr<tile_chunk>> m_base;
+
+	std::vector<uint32_t> m_changed_chunks;
+
+	// load() scratch
+	std::vector<uint32_t> m_loading;
+};
+
+// Tiles covered by a camera whose top-left corner is at the given tile
+// position and which shows view tiles, including partially visible ones.
+inline SDL_Rect visible_tiles(vecf camera, veci view)
+{
+	auto const x0 = static_cast<int>(std::floor(camera.x));
+	auto const y0 = static_cast<int>(std::floor(camera.y));
+	auto const x1 = static_cast<int>(std::ceil(camera.x + view.x));
+	auto const y1 = static_cast<int>(std::ceil(camera.y + view.y));
+	return SDL_Rect{ x0, y0, x1 - x0, y1 - y0 };
+}
+
+}}
@@ -0,0 +1,51 @@
+#include "es_lib/sdl.h"
+#include "es_lib/asset_pack.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Converts BMP assets into a single pre-converted pack file:
+//
+//	es_pack <output> <id>=<file.bmp> [<id>=<file.bmp> ...]
+//
+// e.g. es_pack assets/assets.espk 0=assets/rect2985.bmp 1=assets/visual-1.bmp
+
+int main(int argc, char* argv[])
+{
+	using namespace es::sdl;
+
+	if (argc < 3)
+	{
+		printf("usage: %s <output> <id>=<file.bmp> [<id>=<file.bmp> ...]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<surface_t> surfaces;
+	std::vector<std::pair<uint32_t, SDL_Surface*>> assets;
+	for (int i = 2; i < argc; i++)
+	{
+		auto const arg = std::string{ argv[i] };
+		auto const eq = arg.find('=');
+		if (eq == std::string::npos || eq == 0)
+		{
+			printf("Fail | expected <id>=<file.bmp>, got '%s'\n", argv[i]);
+			return 1;
+		}
+
+		auto const id = static_cast<uint32_t>(std::strtoul(arg.substr(0, eq).c_str(), nullptr, 10));
+		surfaces.push_back(create_bmp(arg.substr(eq + 1).c_str()));
+		if (!surfaces.back())
+			return 1;
+
+		assets.emplace_back(id, surfaces.back().get());
+		printf("%u: %s (%dx%d)\n", id, arg.c_str() + eq + 1, surfaces.back()->w, surfaces.back()->h);
+	}
+
+	if (!write_asset_pack(argv[1], assets))
+		return 1;
+
+	printf("wrote %zu assets to %s\n", assets.size(), argv[1]);
+	return 0;
+}
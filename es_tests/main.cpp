@@ -1,5 +1,1041 @@
+#include "es_lib/sdl.h"
+#include "es_lib/scoped_render.h"
+#include "es_lib/command_buffer.h"
+#include "es_lib/tile_layer.h"
+#include "es_lib/atlas.h"
+#include "es_lib/tile_map.h"
+#include "es_lib/entity_store.h"
+#include "es_lib/job_system.h"
+#include "es_lib/level_stream.h"
+#include "es_lib/particles.h"
+#include "es_lib/snapshot.h"
+#include "es_lib/collision.h"
+#include "es_lib/pathfinding.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
 
-int main()
+// Renders synthetic scenes through scoped_render on a headless context and
+// reports frame time percentiles and draw throughput. Systems without a
+// visible result are also checked against simple reference versions; any
+// mismatch is printed and makes the run exit with 1.
+//
+//	es_tests [frames_per_scene]
+
+namespace
+{
+
+using namespace es::sdl;
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr auto num_blocks = veci{ 32, 18 };
+
+struct scene
+{
+	char const* name;
+	int tiles;
+	int sprites;
+	int textures;
+	bool atlas;
+	bool cached_tiles;
+	int world;		// side of a square tile_map drawn through a panning camera, 0 for none
+	bool pipelined;	// sprites are updated and recorded on a worker while the previous frame draws
+	bool streamed;	// the world is written to a level file and streamed back around the camera
+};
+
+// Deterministic so that runs are comparable.
+struct lcg
+{
+	uint32_t state = 12345;
+
+	uint32_t next() { state = state * 1664525u + 1013904223u; return state >> 8; }
+
+	float unit() { return static_cast<float>(next() & 0xffff) / 0xffff; }
+};
+
+surface_t create_solid(uint32_t seed)
+{
+	auto s = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, 32, 32, 32, SDL_PIXELFORMAT_RGBA32)) };
+	ES_EXPECT_SDL_ZERO(SDL_FillRect(s.get(), nullptr, SDL_MapRGBA(s->format, seed * 37 & 0xff, seed * 91 & 0xff, seed * 53 & 0xff, 0xff)));
+	return s;
+}
+
+int failures = 0;
+
+void expect(bool condition, char const* what)
+{
+	if (condition)
+		return;
+
+	printf("Fail | %s\n", what);
+	failures++;
+}
+
+float percentile(std::vector<float> sorted, float p)
+{
+	if (sorted.empty())
+		return 0.0f;
+
+	std::sort(sorted.begin(), sorted.end());
+	auto const i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5f);
+	return sorted[i];
+}
+
+void run(scene const& sc, int frames, job_system& jobs)
+{
+	context_config config;
+	config.headless = true;
+	context c{ config };
+
+	texture_atlas atlas;
+	for (int i = 0; i < sc.textures; i++)
+	{
+		auto const id = static_cast<uint32_t>(i + 1);
+		if (sc.atlas)
+		{
+			atlas.add(id, create_solid(id));
+		}
+		else
+		{
+			c.add_texture(id, create_solid(id));
+		}
+	}
+	if (sc.atlas)
+	{
+		atlas.build(c);
+	}
+
+	lcg rng;
+
+	// The tile layer draws through context::texture_at, so cached scenes keep
+	// their own copy of the textures outside the atlas.
+	tile_layer layer{ num_blocks };
+	if (sc.cached_tiles)
+	{
+		for (int i = 0; sc.atlas && i < sc.textures; i++)
+		{
+			auto const id = static_cast<uint32_t>(i + 1);
+			c.add_texture(id, create_solid(id));
+		}
+		for (int i = 0; i < sc.tiles; i++)
+		{
+			auto const visual = int64_t{ 1 } + rng.next() % sc.textures;
+			layer.set(i % num_blocks.x, (i / num_blocks.x) % num_blocks.y, visual << 32);
+		}
+	}
+
+	tile_map world{ std::max(sc.world, 1), std::max(sc.world, 1) };
+	for (int y = 0; y < sc.world; y++)
+	{
+		for (int x = 0; x < sc.world; x++)
+		{
+			world.set(x, y, 1 + rng.next() % sc.textures, 0);
+		}
+	}
+
+	auto const level_path = "es_tests_world.eslv";
+	level_streamer streamer;
+	if (sc.streamed)
+	{
+		write_level(level_path, world);
+		streamer.open(level_path);
+	}
+
+	entity_store sprites;
+	sprites.reserve(static_cast<size_t>(sc.sprites));
+	for (int i = 0; i < sc.sprites; i++)
+	{
+		sprite s{};
+		s.size = vecf{ 1.0f, 1.0f };
+		s.visual = static_cast<int32_t>(1 + rng.next() % sc.textures);
+		s.position = vecf{ rng.unit() * num_blocks.x, rng.unit() * num_blocks.y };
+		s.velocity = vecf{ rng.unit() - 0.5f, rng.unit() - 0.5f };
+		sprites.create(s);
+	}
+
+	std::vector<uint32_t> tile_visuals(static_cast<size_t>(sc.tiles));
+	for (auto& v : tile_visuals)
+	{
+		v = 1 + rng.next() % sc.textures;
+	}
+
+	render_pipeline pipeline;
+	record_target target;
+	resolve(c, target);
+
+	std::vector<float> frame_ms;
+	frame_ms.reserve(static_cast<size_t>(frames));
+
+	auto const draws_before = c.draw_calls();
+	auto const start = bench_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		auto const frame_start = bench_clock::now();
+
+		job_counter recorded;
+		if (sc.pipelined)
+		{
+			jobs.run([&]
+			{
+				sprites.integrate(jobs, 0.1f);
+
+				scoped_render record{ target, num_blocks, pipeline.back() };
+				record.use_atlas(atlas);
+				record.add(sprites);
+			}, &recorded);
+		}
+
+		{
+			scoped_render render{ c, num_blocks };
+			render.set_frames_per_second(0);
+			if (sc.atlas)
+			{
+				render.use_atlas(atlas);
+			}
+
+			if (sc.world)
+			{
+				auto const t = static_cast<float>(f) / frames;
+				auto const camera = vecf{ t * (sc.world - num_blocks.x), t * (sc.world - num_blocks.y) };
+				render.set_camera(camera);
+				if (sc.streamed)
+				{
+					streamer.update(camera, num_blocks);
+					render.add(streamer.map());
+				}
+				else
+				{
+					render.add(world);
+				}
+			}
+
+			if (sc.cached_tiles)
+			{
+				render.add(layer);
+			}
+			else
+			{
+				auto const ws = c.get_window_size();
+				auto const unit = veci{ ws.first / num_blocks.x, ws.second / num_blocks.y };
+				for (int i = 0; i < sc.tiles; i++)
+				{
+					auto const x = i % num_blocks.x;
+					auto const y = (i / num_blocks.x) % num_blocks.y;
+					auto const dest = SDL_Rect{ x * unit.x, y * unit.y, unit.x, unit.y };
+					if (sc.atlas)
+					{
+						atlas.batch().add(atlas.at(tile_visuals[i]), dest);
+					}
+					else
+					{
+						render.add_to(c.texture_at(tile_visuals[i]), dest);
+					}
+				}
+			}
+
+			if (sc.pipelined)
+			{
+				render.add(pipeline.front());
+			}
+			else
+			{
+				sprites.integrate(jobs, 0.1f);
+				render.add(sprites);
+			}
+		}
+
+		jobs.wait(recorded);
+		pipeline.swap();
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(bench_clock::now() - frame_start).count());
+	}
+	auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+	auto const draws = c.draw_calls() - draws_before;
+
+	printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", sc.name,
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.9f), percentile(frame_ms, 0.99f),
+		*std::max_element(frame_ms.begin(), frame_ms.end()),
+		draws / elapsed, static_cast<double>(draws) / frames);
+
+	if (sc.streamed)
+		std::remove(level_path);
+}
+
+// Atlas sprites drawn between direct copies on a higher layer: the atlas
+// quads still go out as one run, and the layers decide what ends on top.
+void check_atlas_batch()
+{
+	context_config config;
+	config.headless = true;
+	context c{ config };
+
+	texture_atlas atlas;
+	atlas.add(1, create_solid(1));
+	atlas.add(2, create_solid(2));
+	atlas.build(c);
+	c.add_texture(3, create_solid(3));
+
+	auto const ws = c.get_window_size();
+	auto const unit = veci{ ws.first / num_blocks.x, ws.second / num_blocks.y };
+	auto const block = [&](int x, int y) { return SDL_Rect{ x * unit.x, y * unit.y, unit.x, unit.y }; };
+
+	constexpr auto count = 8;
+	auto const draws_before = c.draw_calls();
+	{
+		scoped_render render{ c, num_blocks };
+		render.set_frames_per_second(0);
+		render.use_atlas(atlas);
+		render.set_layer(3);
+		for (int i = 0; i < count; i++)
+		{
+			// the first copy covers the sprite added after it
+			render.add_to(c.texture_at(3), block(i ? 2 * i + 1 : 0, 1));
+
+			sprite s{};
+			s.size = vecf{ 1.0f, 1.0f };
+			s.visual = 1 + i % 2;
+			s.position = vecf{ 2.0f * i, 1.0f };
+			render.add(s);
+		}
+	}
+	expect(c.draw_calls() - draws_before == count + 1, "atlas batch: one run for the atlas quads plus the direct copies");
+
+	auto const target = c.get_window_surface();
+	auto const pixel_at = [&](SDL_Rect r)
+	{
+		return *reinterpret_cast<uint32_t const*>(static_cast<uint8_t const*>(target->pixels) + (r.y + r.h / 2) * target->pitch + (r.x + r.w / 2) * 4);
+	};
+	auto const solid = [](uint32_t seed) { return *static_cast<uint32_t const*>(create_solid(seed)->pixels); };
+
+	expect(pixel_at(block(0, 1)) == solid(3), "atlas batch: a higher layer covers an atlas quad added after it");
+	for (int i = 1; i < count; i++)
+	{
+		expect(pixel_at(block(2 * i, 1)) == solid(1 + i % 2), "atlas batch: atlas quad drawn from its page");
+		expect(pixel_at(block(2 * i + 1, 1)) == solid(3), "atlas batch: direct copy drawn");
+	}
+}
+
+// Streams a row of eight chunks past a camera one chunk wide, with room
+// for three: checks the chunks read back from the file, the resident set
+// and that the least recently used chunk is the one evicted.
+void check_level_streaming()
+{
+	constexpr auto num_chunks = 8;
+	constexpr auto empty_chunk = 6;
+	tile_map world{ num_chunks * chunk_size, chunk_size };
+	for (int y = 0; y < world.height(); y++)
+	{
+		for (int x = 0; x < world.width(); x++)
+		{
+			// runs of three tiles, and runs of empty tiles in the last chunk
+			auto const cx = x / chunk_size;
+			if (cx == empty_chunk || (cx == num_chunks - 1 && x % chunk_size < 4))
+				continue;
+			world.set(x, y, 1 + (x / 3 + y) % 5, (x / 7) % 2);
+		}
+	}
+
+	auto const level_path = "es_tests_stream.eslv";
+	expect(write_level(level_path, world), "streaming: level written");
+
+	level_streamer streamer{ 3 * sizeof(tile_chunk), 0 };
+	expect(streamer.open(level_path), "streaming: level opened");
+
+	auto const visit = [&](int cx, size_t loads)
+	{
+		auto const camera = vecf{ static_cast<float>(cx * chunk_size), 0.0f };
+		streamer.update(camera, num_blocks);
+		for (int tries = 0; streamer.chunks_loaded() < loads && tries < 2000; tries++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			streamer.update(camera, num_blocks);
+		}
+		expect(streamer.chunks_loaded() == loads, "streaming: chunk in view loaded");
+		expect(streamer.resident_bytes() <= streamer.budget(), "streaming: resident chunks within the budget");
+
+		auto same = true;
+		for (int y = 0; y < chunk_size; y++)
+		{
+			for (int x = cx * chunk_size; x < (cx + 1) * chunk_size; x++)
+			{
+				same = same && streamer.map().visual_at(x, y) == world.visual_at(x, y) && streamer.map().physical_at(x, y) == world.physical_at(x, y);
+			}
+		}
+		expect(same, "streaming: chunk read back as written");
+	};
+	auto const resident = [&](int cx) { return streamer.map().chunk_at(cx, 0) != nullptr; };
+
+	for (int cx = 0; cx < 5; cx++)
+	{
+		visit(cx, static_cast<size_t>(cx + 1));
+	}
+	expect(!resident(0) && !resident(1) && resident(2) && resident(3) && resident(4), "streaming: oldest chunks evicted first");
+	expect(streamer.chunks_evicted() == 2, "streaming: two chunks evicted");
+
+	// back to chunk 2, so 3 is now the least recently used
+	visit(2, 5);
+	visit(5, 6);
+	expect(resident(2) && !resident(3) && resident(4) && resident(5), "streaming: a revisited chunk is kept over an older one");
+	expect(streamer.chunks_evicted() == 3, "streaming: one more chunk evicted");
+
+	// an empty chunk takes no memory and evicts nothing
+	visit(empty_chunk, 7);
+	expect(!resident(empty_chunk) && streamer.chunks_evicted() == 3, "streaming: empty chunk costs nothing");
+	visit(num_chunks - 1, 8);
+
+	std::remove(level_path);
+}
+
+// Surface path used without an accelerated renderer: 1000 blended 32x32
+// quads scaled to 40x40 per frame onto the headless target, or onto a
+// surface of dest_format the way a window surface would be.
+void run_blits(char const* name, int frames, bool use_sdl, blit_filter filter, Uint32 dest_format = SDL_PIXELFORMAT_RGBA32)
+{
+	context_config config;
+	config.headless = true;
+	context c{ config };
+	c.set_blit_filter(filter);
+
+	auto const ws = c.get_window_size();
+	auto sprite = create_solid(7);
+	SDL_SetSurfaceBlendMode(sprite.get(), SDL_BLENDMODE_BLEND);
+
+	surface_t window;
+	software_blitter blitter{ filter };
+	if (dest_format != SDL_PIXELFORMAT_RGBA32)
+		window = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, ws.first, ws.second, 32, dest_format)) };
+
+	lcg rng;
+	std::vector<blit_quad> quads(1000);
+	for (auto& q : quads)
+	{
+		q = blit_quad{ sprite.get(), SDL_Rect{ 0, 0, 32, 32 }, SDL_Rect{ static_cast<int>(rng.next() % (ws.first - 40)), static_cast<int>(rng.next() % (ws.second - 40)), 40, 40 } };
+	}
+
+	std::vector<float> frame_ms;
+	auto const start = bench_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		auto const frame_start = bench_clock::now();
+		if (use_sdl)
+		{
+			for (auto& q : quads)
+				SDL_BlitScaled(q.surface, &q.src, c.get_window_surface(), &q.dest);
+		}
+		else if (window)
+		{
+			blitter.blit(window.get(), quads.data(), quads.size());
+		}
+		else
+		{
+			c.blit_surfaces(quads.data(), quads.size());
+		}
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(bench_clock::now() - frame_start).count());
+	}
+	auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", name,
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.9f), percentile(frame_ms, 0.99f),
+		*std::max_element(frame_ms.begin(), frame_ms.end()),
+		quads.size() * frames / elapsed, static_cast<double>(quads.size()));
+}
+
+
+// The entity integration kernels against the scalar loop, including a tail
+// shorter than either vector width.
+void check_integrate()
+{
+	lcg rng;
+	constexpr size_t n = 1027;
+	std::vector<float> p(n), v(n), a(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		p[i] = rng.unit() * 100.0f;
+		v[i] = rng.unit() - 0.5f;
+		a[i] = rng.unit() * 40.0f;
+	}
+
+	auto const dt = 1.0f / 60;
+	auto ep = p, ev = v;
+	for (size_t i = 0; i < n; i++)
+	{
+		ev[i] += a[i] * dt;
+		ep[i] += ev[i] * dt;
+	}
+
+	// the scalar loop may be contracted into fused multiply-adds
+	auto const close = [](std::vector<float> const& x, std::vector<float> const& y)
+	{
+		for (size_t i = 0; i < x.size(); i++)
+		{
+			if (std::abs(x[i] - y[i]) > 1e-5f * std::max(1.0f, std::abs(y[i])))
+				return false;
+		}
+		return true;
+	};
+
+	auto op = p, ov = v;
+	detail::integrate_axis_sse2(op.data(), ov.data(), a.data(), n, dt);
+	expect(close(op, ep) && close(ov, ev), "integrate_axis_sse2 matches the scalar loop");
+#if defined(ES_HAS_AVX2_DISPATCH)
+	if (detail::cpu_has_avx2())
+	{
+		op = p;
+		ov = v;
+		detail::integrate_axis_avx2(op.data(), ov.data(), a.data(), n, dt);
+		expect(close(op, ep) && close(ov, ev), "integrate_axis_avx2 matches the scalar loop");
+	}
+#endif
+}
+
+// The SIMD kernels must match the scalar ones byte for byte, and blitting
+// onto ARGB8888 must give the same pixels as blitting onto RGBA32.
+void check_blits()
+{
+	lcg rng;
+	auto const pixel = [&rng] { return rng.next() << 8 ^ rng.next(); };
+
+	constexpr size_t n = 1027;
+	std::vector<uint32_t> src(n), dst(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		src[i] = pixel();
+		dst[i] = pixel();
+	}
+
+	for (uint32_t ashift = 0; ashift < 32; ashift += 24)
+	{
+		auto expected = dst;
+		detail::blend_span_scalar(expected.data(), src.data(), n, ashift);
+#if defined(ES_HAS_SSE2)
+		auto out = dst;
+		detail::blend_span_sse2(out.data(), src.data(), n, ashift);
+		expect(out == expected, "blend_span_sse2 matches the scalar kernel");
+#endif
+#if defined(ES_HAS_AVX2_DISPATCH)
+		if (detail::cpu_has_avx2())
+		{
+			out = dst;
+			detail::blend_span_avx2(out.data(), src.data(), n, ashift);
+			expect(out == expected, "blend_span_avx2 matches the scalar kernel");
+		}
+#endif
+	}
+
+	std::vector<int32_t> x0(n), x1(n);
+	std::vector<uint16_t> fx(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		x0[i] = static_cast<int32_t>(rng.next() % (n - 1));
+		x1[i] = x0[i] + 1;
+		fx[i] = static_cast<uint16_t>(rng.next() & 0xff);
+	}
+	std::vector<uint32_t> expected(n);
+	detail::bilinear_span_scalar(expected.data(), src.data(), dst.data(), x0.data(), x1.data(), fx.data(), 77, n);
+	auto const rgba_to_argb = detail::swizzle{ { 0, 8, 16, 24 }, { 16, 8, 0, 24 } };
+#if defined(ES_HAS_SSE2)
+	std::vector<uint32_t> out(n);
+	detail::bilinear_span_sse2(out.data(), src.data(), dst.data(), x0.data(), x1.data(), fx.data(), 77, n);
+	expect(out == expected, "bilinear_span_sse2 matches the scalar kernel");
+
+	out = src;
+	expected = src;
+	detail::swizzle_span_scalar(expected.data(), n, rgba_to_argb);
+	detail::swizzle_span_sse2(out.data(), n, rgba_to_argb);
+	expect(out == expected, "swizzle_span_sse2 matches the scalar kernel");
+#endif
+
+	auto sprite = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, 32, 32, 32, SDL_PIXELFORMAT_RGBA32)) };
+	for (int y = 0; y < sprite->h; y++)
+	{
+		auto const p = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(sprite->pixels) + y * sprite->pitch);
+		for (int x = 0; x < sprite->w; x++)
+			p[x] = pixel();
+	}
+	SDL_SetSurfaceBlendMode(sprite.get(), SDL_BLENDMODE_BLEND);
+
+	auto const dest = SDL_Rect{ 3, 5, 41, 37 };
+	for (auto const filter : { blit_filter::nearest, blit_filter::bilinear })
+	{
+		auto rgba = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, 48, 48, 32, SDL_PIXELFORMAT_RGBA32)) };
+		auto argb = surface_t{ ES_EXPECT_SDL_PTR(SDL_CreateRGBSurfaceWithFormat(0, 48, 48, 32, SDL_PIXELFORMAT_ARGB8888)) };
+		ES_EXPECT_SDL_ZERO(SDL_FillRect(rgba.get(), nullptr, SDL_MapRGBA(rgba->format, 40, 80, 120, 160)));
+		ES_EXPECT_SDL_ZERO(SDL_FillRect(argb.get(), nullptr, SDL_MapRGBA(argb->format, 40, 80, 120, 160)));
+
+		software_blitter blitter{ filter };
+		expect(software_blitter::supports(sprite.get(), argb.get()), "software_blitter takes RGBA32 onto ARGB8888");
+		blitter.blit(sprite.get(), nullptr, rgba.get(), &dest);
+		blitter.blit(sprite.get(), nullptr, argb.get(), &dest);
+
+		auto same = true;
+		for (int y = 0; y < rgba->h; y++)
+		{
+			auto const a = reinterpret_cast<uint32_t const*>(static_cast<uint8_t const*>(rgba->pixels) + y * rgba->pitch);
+			auto b = std::vector<uint32_t>(a, a + rgba->w);
+			detail::swizzle_span_scalar(b.data(), b.size(), rgba_to_argb);
+			same = same && std::memcmp(b.data(), static_cast<uint8_t const*>(argb->pixels) + y * argb->pitch, b.size() * sizeof(uint32_t)) == 0;
+		}
+		expect(same, "blits onto ARGB8888 match blits onto RGBA32");
+	}
+}
+
+// Four emitters on two textures spawning rate particles per second between
+// them, updated at 60 ticks per second and drawn every frame. The last two
+// columns count particles drawn rather than draw calls.
+void run_particles(char const* name, int frames, float rate)
 {
-	return 0;
+	context_config config;
+	config.headless = true;
+	context c{ config };
+	// surfaces too, for the CPU path used without SDL_RenderGeometry
+	c.add_surface(1, create_solid(1));
+	c.add_surface(2, create_solid(2));
+
+	particle_system particles{ 131072 };
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		emitter_config e;
+		e.visual = static_cast<int32_t>(1 + i % 2);
+		e.rate = rate / 4;
+		e.lifetime_min = 0.5f;
+		e.lifetime_max = 1.5f;
+		e.speed_min = 1.0f;
+		e.speed_max = 4.0f;
+		e.gravity = vecf{ 0.0f, 4.0f };
+		e.size_start = 0.4f;
+		e.size_end = 0.1f;
+		particles.add_emitter(e, vecf{ num_blocks.x * (i + 1) / 5.0f, num_blocks.y / 2.0f });
+	}
+
+	// fill the pool to its steady state before measuring
+	for (int f = 0; f < 90; f++)
+	{
+		particles.update(1.0f / 60);
+	}
+
+	std::vector<float> frame_ms;
+	size_t drawn = 0;
+	auto const start = bench_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		auto const frame_start = bench_clock::now();
+		{
+			scoped_render render{ c, num_blocks };
+			render.set_frames_per_second(0);
+			particles.update(1.0f / 60);
+			render.add(particles);
+			drawn += particles.size();
+		}
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(bench_clock::now() - frame_start).count());
+	}
+	auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", name,
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.9f), percentile(frame_ms, 0.99f),
+		*std::max_element(frame_ms.begin(), frame_ms.end()),
+		drawn / elapsed, static_cast<double>(drawn) / frames);
+}
+
+// Saves, restores and diffs the state of entities moving every tick plus a
+// 2048^2 world with a few edited chunks. The last two columns count
+// operations and the kilobytes each one writes.
+void run_snapshots(int frames, int entities)
+{
+	lcg rng;
+	entity_store store;
+	store.reserve(static_cast<size_t>(entities));
+	for (int i = 0; i < entities; i++)
+	{
+		sprite s{};
+		s.size = vecf{ 1.0f, 1.0f };
+		s.visual = static_cast<int32_t>(1 + rng.next() % 64);
+		s.position = vecf{ rng.unit() * num_blocks.x, rng.unit() * num_blocks.y };
+		s.velocity = vecf{ rng.unit() - 0.5f, rng.unit() - 0.5f };
+		store.create(s);
+	}
+
+	tile_map world{ 2048, 2048 };
+	world.mark_clean();
+
+	auto const entities_section = snapshot_tag('E', 'N', 'T', 'S');
+	auto const world_section = snapshot_tag('W', 'R', 'L', 'D');
+	auto const save = [&](std::vector<uint8_t>& out)
+	{
+		snapshot_writer w{ out };
+		w.begin(entities_section);
+		store.save(w);
+		w.end();
+		w.begin(world_section);
+		world.save(w);
+		w.end();
+		w.finish();
+	};
+
+	std::vector<uint8_t> previous;
+	std::vector<uint8_t> current;
+	std::vector<uint8_t> delta;
+	std::vector<uint8_t> rebuilt;
+	save(previous);
+
+	// the last frames also go through a history, to be popped at the end
+	snapshot_history history{ 8, 3 };
+	std::vector<std::vector<uint8_t>> pushed;
+
+	std::vector<float> save_ms, restore_ms, delta_ms;
+	size_t delta_bytes = 0;
+	auto deltas_ok = true;
+	for (int f = 0; f < frames; f++)
+	{
+		// a slice of the entities moves and one tile changes per tick
+		auto const first = static_cast<size_t>(f * 997) % store.size();
+		store.integrate(first, std::min(store.size(), first + store.size() / 8), 1.0f / 60);
+		world.set(static_cast<int>(rng.next() % 2048), static_cast<int>(rng.next() % 2048), 1, 1);
+
+		auto t0 = bench_clock::now();
+		save(current);
+		auto t1 = bench_clock::now();
+		make_snapshot_delta(previous, current, delta);
+		auto t2 = bench_clock::now();
+
+		snapshot_reader r{ current };
+		uint32_t tag;
+		while (r.next(tag))
+		{
+			if (tag == entities_section)
+				store.load(r);
+			else if (tag == world_section)
+				world.load(r);
+		}
+		auto t3 = bench_clock::now();
+
+		save_ms.push_back(std::chrono::duration<float, std::milli>(t1 - t0).count());
+		delta_ms.push_back(std::chrono::duration<float, std::milli>(t2 - t1).count());
+		restore_ms.push_back(std::chrono::duration<float, std::milli>(t3 - t2).count());
+		delta_bytes += delta.size();
+
+		if (f == 0 || f == frames - 1)
+			deltas_ok = deltas_ok && apply_snapshot_delta(previous, delta, rebuilt) && rebuilt == current;
+		if (f + 8 >= frames)
+		{
+			history.push(current);
+			pushed.push_back(current);
+		}
+		std::swap(previous, current);
+	}
+	expect(deltas_ok, "applying a snapshot delta to its base gives the target");
+
+	// what was loaded saves to the same bytes
+	save(current);
+	expect(current == previous, "saving a loaded snapshot gives the same bytes");
+
+	auto history_ok = true;
+	while (!pushed.empty())
+	{
+		history_ok = history_ok && history.pop(rebuilt) && rebuilt == pushed.back();
+		pushed.pop_back();
+	}
+	expect(history_ok && history.empty() && !history.pop(rebuilt), "snapshot_history pops what was pushed, newest first");
+
+	// particles saved with their generator carry on exactly as before
+	{
+		particle_system particles{ 4096, 7 };
+		emitter_config e;
+		e.rate = 600.0f;
+		e.speed_max = 3.0f;
+		e.gravity = vecf{ 0.0f, 4.0f };
+		particles.add_emitter(e, vecf{ 8.0f, 8.0f });
+		for (int t = 0; t < 30; t++)
+			particles.update(1.0f / 60);
+
+		std::vector<uint8_t> saved, first_run, second_run;
+		auto const particles_section = snapshot_tag('P', 'R', 'T', 'S');
+		auto const save_particles = [&](std::vector<uint8_t>& out)
+		{
+			snapshot_writer w{ out };
+			w.begin(particles_section);
+			particles.save(w);
+			w.end();
+			w.finish();
+		};
+		auto const run_on = [&](std::vector<uint8_t>& out)
+		{
+			for (int t = 0; t < 30; t++)
+				particles.update(1.0f / 60);
+			save_particles(out);
+		};
+
+		save_particles(saved);
+		run_on(first_run);
+		snapshot_reader r{ saved };
+		uint32_t tag;
+		auto loaded = r.next(tag) && tag == particles_section && particles.load(r);
+		run_on(second_run);
+		expect(loaded && particles.size() > 0 && first_run == second_run, "particle_system continues identically after a load");
+	}
+
+	auto const row = [frames](char const* name, std::vector<float> const& ms, double bytes)
+	{
+		auto total = 0.0;
+		for (auto const m : ms)
+			total += m;
+
+		printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", name,
+			percentile(ms, 0.5f), percentile(ms, 0.9f), percentile(ms, 0.99f),
+			*std::max_element(ms.begin(), ms.end()),
+			frames / (total / 1000.0), bytes / 1024.0);
+	};
+
+	char name[64];
+	snprintf(name, sizeof(name), "snapshot %d ents, save", entities);
+	row(name, save_ms, static_cast<double>(previous.size()));
+	snprintf(name, sizeof(name), "snapshot %d ents, restore", entities);
+	row(name, restore_ms, static_cast<double>(previous.size()));
+	snprintf(name, sizeof(name), "snapshot %d ents, delta", entities);
+	row(name, delta_ms, static_cast<double>(delta_bytes) / frames);
+}
+
+// Sum of the step costs along path, or unreachable if a step is not a legal
+// move from the tile before it.
+uint32_t path_cost(tile_map const& map, veci start, std::vector<veci> const& path)
+{
+	uint32_t cost = 0;
+	auto at = start;
+	for (auto const p : path)
+	{
+		auto const s = std::find_if(std::begin(path_steps), std::end(path_steps), [&](path_step const& s) { return at.x + s.dx == p.x && at.y + s.dy == p.y; });
+		if (s == std::end(path_steps) || !can_step(map, at.x, at.y, *s))
+			return unreachable;
+
+		cost += s->cost;
+		at = p;
+	}
+	return cost;
+}
+
+// A 128^2 map split by a wall with one gap. Every frame one tile toggles,
+// the flow field to a goal behind the wall is fetched from flow_field_cache,
+// which has to rebuild it, and agents find their own way there with
+// path_finder. The first and last frames check the paths against the
+// field's costs. The last two columns count paths found.
+void run_pathfinding(int frames, int agents)
+{
+	// on an open map a path is as long as the larger of dx and dy
+	{
+		tile_map open{ 32, 32 };
+		path_finder finder;
+		std::vector<veci> path;
+		expect(finder.find_path(open, veci{ 10, 10 }, veci{ 20, 14 }, path), "path_finder finds a path on an open map");
+		expect(path.size() == 10 && path_cost(open, veci{ 10, 10 }, path) == 6 * 10 + 4 * 14, "path_finder takes the shortest path on an open map");
+	}
+
+	tile_map map{ 128, 128 };
+	for (int y = 0; y < map.height(); y++)
+	{
+		if (y != 100)
+			map.set(64, y, 1, 1);
+	}
+
+	lcg rng;
+	std::vector<veci> starts;
+	while (starts.size() < static_cast<size_t>(agents))
+	{
+		auto const p = veci{ static_cast<int>(rng.next() % 64), static_cast<int>(rng.next() % 128) };
+		if (p.x != 32 || p.y != 32)
+			starts.push_back(p);
+	}
+
+	auto const goal = veci{ 124, 10 };
+	flow_field_cache cache;
+	path_finder finder;
+	std::vector<veci> path;
+
+	{
+		auto const& field = cache.get(map, goal);
+		expect(!field.stale(map), "a fresh flow field is not stale");
+		map.set(32, 32, 1, 1);
+		expect(field.stale(map), "tile_map::set makes the flow field over it stale");
+		auto const builds = cache.builds();
+		expect(&cache.get(map, goal) == &field && cache.builds() == builds + 1 && !field.stale(map), "flow_field_cache rebuilds a stale field");
+		expect(field.cost(32, 32) == unreachable, "the rebuilt field sees the new wall");
+		cache.get(map, goal);
+		expect(cache.builds() == builds + 1, "flow_field_cache keeps a field that is still valid");
+	}
+
+	std::vector<float> frame_ms;
+	size_t found = 0;
+	auto const start = bench_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		auto const frame_start = bench_clock::now();
+		map.set(32, 32, 1, f % 2);
+		auto const& field = cache.get(map, goal);
+		auto valid = true;
+		for (auto const s : starts)
+		{
+			if (!finder.find_path(map, s, goal, path))
+				continue;
+
+			found++;
+			if (f == 0 || f == frames - 1)
+				valid = valid && path.back().x == goal.x && path.back().y == goal.y && path_cost(map, s, path) == field.cost(s.x, s.y);
+		}
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(bench_clock::now() - frame_start).count());
+
+		if (f == 0 || f == frames - 1)
+		{
+			expect(valid, "path_finder paths are legal and as cheap as the flow field");
+
+			// following the field costs what it says
+			auto const s = starts.front();
+			auto at = s;
+			uint32_t walked = 0;
+			for (int i = 0; i < map.width() * map.height() && (at.x != goal.x || at.y != goal.y); i++)
+			{
+				auto const step = field.step(at.x, at.y);
+				if (!step.x && !step.y)
+					break;
+
+				walked += step.x && step.y ? 14 : 10;
+				at = veci{ at.x + step.x, at.y + step.y };
+			}
+			expect(at.x == goal.x && at.y == goal.y && walked == field.cost(s.x, s.y), "flow_field steps lead to the goal at the field's cost");
+		}
+	}
+	auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+	expect(found == starts.size() * frames, "every agent reaches the goal");
+
+	char name[64];
+	snprintf(name, sizeof(name), "pathfinding %d agents", agents);
+	printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", name,
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.9f), percentile(frame_ms, 0.99f),
+		*std::max_element(frame_ms.begin(), frame_ms.end()),
+		found / elapsed, static_cast<double>(found) / frames);
+}
+
+// Moves n boxes of up to 3x3 blocks around a 256^2 area and collects the
+// overlapping pairs through spatial_hash every frame. The first and last
+// frames are compared against testing every pair. The last two columns
+// count pairs found.
+void run_broadphase(int frames, int n)
+{
+	lcg rng;
+	std::vector<aabb> boxes(static_cast<size_t>(n));
+	std::vector<vecf> velocity(boxes.size());
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		auto const p = vecf{ rng.unit() * 256.0f, rng.unit() * 256.0f };
+		auto const size = vecf{ 0.5f + rng.unit() * 2.5f, 0.5f + rng.unit() * 2.5f };
+		boxes[i] = aabb{ p, vecf{ p.x + size.x, p.y + size.y } };
+		velocity[i] = vecf{ rng.unit() - 0.5f, rng.unit() - 0.5f };
+	}
+
+	spatial_hash hash{ 4.0f };
+	std::vector<std::pair<uint32_t, uint32_t>> pairs;
+	std::vector<std::pair<uint32_t, uint32_t>> expected;
+
+	auto const brute_force = [&]
+	{
+		expected.clear();
+		for (uint32_t a = 0; a < boxes.size(); a++)
+		{
+			for (uint32_t b = a + 1; b < boxes.size(); b++)
+			{
+				if (overlaps(boxes[a], boxes[b]))
+					expected.emplace_back(a, b);
+			}
+		}
+	};
+
+	std::vector<float> frame_ms;
+	size_t found = 0;
+	auto const start = bench_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		auto const frame_start = bench_clock::now();
+		for (uint32_t i = 0; i < boxes.size(); i++)
+		{
+			auto& b = boxes[i];
+			b.min.x += velocity[i].x; b.max.x += velocity[i].x;
+			b.min.y += velocity[i].y; b.max.y += velocity[i].y;
+			hash.update(i, b);
+		}
+
+		pairs.clear();
+		hash.for_each_pair([&](uint32_t a, uint32_t b) { pairs.emplace_back(std::min(a, b), std::max(a, b)); });
+		frame_ms.push_back(std::chrono::duration<float, std::milli>(bench_clock::now() - frame_start).count());
+		found += pairs.size();
+
+		if (f == 0 || f == frames - 1)
+		{
+			brute_force();
+			std::sort(pairs.begin(), pairs.end());
+			expect(std::adjacent_find(pairs.begin(), pairs.end()) == pairs.end(), "spatial_hash reported a pair twice");
+			expect(pairs == expected, "spatial_hash pairs differ from testing every pair");
+		}
+	}
+	auto const elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	char name[64];
+	snprintf(name, sizeof(name), "broadphase %d boxes", n);
+	printf("%-28s %8.3f %8.3f %8.3f %8.3f %12.0f %10.1f\n", name,
+		percentile(frame_ms, 0.5f), percentile(frame_ms, 0.9f), percentile(frame_ms, 0.99f),
+		*std::max_element(frame_ms.begin(), frame_ms.end()),
+		found / elapsed, static_cast<double>(found) / frames);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	auto const frames = argc > 1 ? std::max(1, std::atoi(argv[1])) : 300;
+
+	scene const scenes[] =
+	{
+		//  name                       tiles  sprites textures atlas  cached  world  piped  stream
+		{ "tiles 576, 4 tex",            576,      0,       4, false, false,     0, false, false },
+		{ "tiles 576, 4 tex, atlas",     576,      0,       4, true,  false,     0, false, false },
+		{ "tiles 576, 4 tex, cached",    576,      0,       4, false, true,      0, false, false },
+		{ "sprites 100, 4 tex",            0,    100,       4, false, false,     0, false, false },
+		{ "sprites 1000, 4 tex",           0,   1000,       4, false, false,     0, false, false },
+		{ "sprites 1000, 64 tex",          0,   1000,      64, false, false,     0, false, false },
+		{ "sprites 1000, 64 tex, atlas",   0,   1000,      64, true,  false,     0, false, false },
+		{ "sprites 20000, 64 tex, atlas",  0,  20000,      64, true,  false,     0, false, false },
+		{ "sprites 20000, 64 tex, piped",  0,  20000,      64, true,  false,     0, true,  false },
+		{ "mixed 576+1000, 16 tex",      576,   1000,      16, false, false,     0, false, false },
+		{ "mixed 576+1000, 16 tex, opt", 576,   1000,      16, true,  true,      0, false, false },
+		{ "world 2048^2, culled",          0,      0,       4, true,  false,  2048, false, false },
+		{ "world 2048^2, streamed",        0,      0,       4, true,  false,  2048, false, true  },
+	};
+
+	printf("%d frames per scene\n", frames);
+	printf("%-28s %8s %8s %8s %8s %12s %10s\n", "scene", "p50 ms", "p90 ms", "p99 ms", "max ms", "draws/sec", "draws/frm");
+	job_system jobs;
+	for (auto const& sc : scenes)
+	{
+		run(sc, frames, jobs);
+	}
+	check_atlas_batch();
+	check_level_streaming();
+
+	run_blits("blit 1000, SDL_BlitScaled", frames, true, blit_filter::nearest);
+	run_blits(software_blitter::uses_avx2() ? "blit 1000, nearest, avx2" : "blit 1000, nearest", frames, false, blit_filter::nearest);
+	run_blits("blit 1000, bilinear", frames, false, blit_filter::bilinear);
+	run_blits("blit 1000, onto argb8888", frames, false, blit_filter::nearest, SDL_PIXELFORMAT_ARGB8888);
+	check_blits();
+	check_integrate();
+
+	run_particles("particles 10000/s", frames, 10000.0f);
+	run_particles("particles 60000/s", frames, 60000.0f);
+
+	run_snapshots(frames, 20000);
+
+	run_broadphase(frames, 2000);
+
+	run_pathfinding(frames, 16);
+	return failures ? 1 : 0;
 }